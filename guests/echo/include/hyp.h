@@ -0,0 +1,10 @@
+#ifndef _HYP_H
+#define _HYP_H
+
+/* aVisor scheduling hypercalls, see include/common/hypercall.h there */
+extern long hyp_yield(void);
+extern long hyp_yield_to(unsigned long vm_id);
+extern long hyp_sleep_until(unsigned long timer_count);
+extern unsigned long hyp_remaining_slice(void);
+
+#endif /*_HYP_H */
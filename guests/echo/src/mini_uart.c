@@ -1,5 +1,6 @@
 #include "peripherals/mini_uart.h"
 #include "peripherals/gpio.h"
+#include "hyp.h"
 #include "utils.h"
 
 void uart_send(char c)
@@ -29,6 +30,8 @@ char uart_recv(void)
 	while (1) {
 		if (get32(AUX_MU_LSR_REG) & 0x01)
 			break;
+		/* nothing to read, let the other VMs run */
+		hyp_yield();
 	}
 	return (get32(AUX_MU_IO_REG) & 0xFF);
 }
@@ -0,0 +1,9 @@
+#ifndef _BALLOON_H
+#define _BALLOON_H
+
+#define BALLOON_MAX_PAGES 4096 // 16 MiB
+#define BALLOON_BATCH 64 // pages moved per call
+
+void balloon_update(void);
+
+#endif /*_BALLOON_H */
@@ -34,6 +34,7 @@
 #include "sched.h"
 
 unsigned long get_free_page();
+unsigned long reserve_free_page();
 void free_page(unsigned long p);
 void map_page(struct task_struct *task, unsigned long va, unsigned long page);
 void memzero(unsigned long src, unsigned long n);
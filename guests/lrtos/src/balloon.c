@@ -0,0 +1,42 @@
+#include "balloon.h"
+#include "hyp.h"
+#include "mm.h"
+
+static unsigned long balloon[BALLOON_MAX_PAGES];
+static long nr_balloon = 0;
+
+/*
+ * Move the balloon a batch of pages towards the target set by the
+ * hypervisor. Inflating gives free pages back to it, deflating takes
+ * them back into mem_map.
+ */
+void balloon_update(void)
+{
+	long target = hyp_balloon_target();
+	unsigned long page;
+	int n;
+
+	if (target < 0)
+		return;
+	if (target > BALLOON_MAX_PAGES)
+		target = BALLOON_MAX_PAGES;
+
+	for (n = 0; n < BALLOON_BATCH && nr_balloon < target; n++) {
+		page = reserve_free_page();
+		if (page == 0)
+			return;
+		if (hyp_balloon_inflate(page) < 0) {
+			free_page(page);
+			return;
+		}
+		balloon[nr_balloon++] = page;
+	}
+
+	for (n = 0; n < BALLOON_BATCH && nr_balloon > target; n++) {
+		page = balloon[nr_balloon - 1];
+		if (hyp_balloon_deflate(page) < 0)
+			return;
+		nr_balloon--;
+		free_page(page);
+	}
+}
@@ -1,7 +1,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "balloon.h"
 #include "fork.h"
+#include "hyp.h"
 #include "irq.h"
 #include "mini_uart.h"
 #include "printf.h"
@@ -40,5 +42,8 @@ void kernel_main()
 
 	while (1) {
 		schedule();
+		/* back in the idle loop, let the other VMs run */
+		balloon_update();
+		hyp_yield();
 	}
 }
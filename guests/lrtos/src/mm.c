@@ -37,6 +37,18 @@ unsigned long get_free_page()
 	return 0;
 }
 
+/* like get_free_page, but the page is handed away, so don't touch it */
+unsigned long reserve_free_page()
+{
+	for (int i = 0; i < PAGING_PAGES; i++) {
+		if (mem_map[i] == 0) {
+			mem_map[i] = 1;
+			return LOW_MEMORY + i * PAGE_SIZE;
+		}
+	}
+	return 0;
+}
+
 void free_page(unsigned long p)
 {
 	mem_map[(p - LOW_MEMORY) / PAGE_SIZE] = 0;
@@ -9,7 +9,10 @@
 
 #include "common/sync_exc.h"
 #include "arch/aarch64/sysregs.h"
+#include "common/balloon.h"
+#include "common/board.h"
 #include "common/debug.h"
+#include "common/hypercall.h"
 #include "common/irq.h"
 #include "common/mm.h"
 #include "common/sched.h"
@@ -79,15 +82,66 @@ const char *sync_error_reasons[] = {
 	"BRK instruction execution in AArch64 state.",
 };
 
-void handle_trap_wfx()
+#define ESR_EL2_ISS_WFX_TI 1 // set for WFE, clear for WFI
+
+void handle_trap_wfx(unsigned long esr)
 {
-	schedule();
 	increment_current_pc(4);
+	sched_note_io(current);
+
+	if (esr & ESR_EL2_ISS_WFX_TI)
+		schedule();
+	else
+		block_current(0);
+}
+
+static long hvc_sleep_until(unsigned long count)
+{
+	struct task_struct *tsk = current;
+
+	if (!HAVE_FUNC(tsk->board_ops, to_physical_count))
+		return -1;
+
+	block_current(tsk->board_ops->to_physical_count(tsk, count));
+	return 0;
 }
 
 void handle_hvc64(unsigned long hvc_nr)
 {
-	WARN("HVC #%d", hvc_nr);
+	struct pt_regs *regs = task_pt_regs(current);
+	unsigned long arg = regs->regs[0];
+
+	if (hvc_nr != HVC_SCHED_REMAINING_SLICE)
+		sched_note_io(current);
+
+	switch (hvc_nr) {
+	case HVC_SCHED_YIELD:
+		regs->regs[0] = 0;
+		schedule();
+		break;
+	case HVC_SCHED_YIELD_TO:
+		regs->regs[0] = yield_to(arg);
+		break;
+	case HVC_SCHED_SLEEP_UNTIL:
+		regs->regs[0] = hvc_sleep_until(arg);
+		break;
+	case HVC_SCHED_REMAINING_SLICE:
+		regs->regs[0] = remaining_slice();
+		break;
+	case HVC_BALLOON_TARGET:
+		regs->regs[0] = current->mm.balloon_target;
+		break;
+	case HVC_BALLOON_INFLATE:
+		regs->regs[0] = balloon_inflate(current, arg);
+		break;
+	case HVC_BALLOON_DEFLATE:
+		regs->regs[0] = balloon_deflate(current, arg);
+		break;
+	default:
+		WARN("HVC #%lu", hvc_nr);
+		regs->regs[0] = -1;
+		break;
+	}
 }
 
 void handle_trap_system(unsigned long esr)
@@ -186,7 +240,7 @@ void handle_sync_exception(unsigned long esr, unsigned long elr,
 	switch (eclass) {
 	case ESR_EL2_EC_TRAP_WFX:
 		current->stat.wfx_trap_count++;
-		handle_trap_wfx();
+		handle_trap_wfx(esr);
 		break;
 	case ESR_EL2_EC_TRAP_FP_REG:
 		WARN("TRAP_FP_REG is not implemented.");
@@ -8,10 +8,12 @@
  */
 
 #include "common/task.h"
+#include "common/balloon.h"
 #include "common/board.h"
 #include "common/debug.h"
 #include "common/entry.h"
 #include "common/fifo.h"
+#include "common/ksm.h"
 #include "common/mm.h"
 #include "common/sched.h"
 #include "common/utils.h"
@@ -19,6 +21,8 @@
 
 int uart_forwarded_task = 0;
 
+DEFINE_SPINLOCK(task_lock);
+
 struct pt_regs *task_pt_regs(struct task_struct *tsk)
 {
 	unsigned long p =
@@ -35,8 +39,10 @@ static void prepare_task(loader_func_t loader, void *arg)
 	/* interrupt mask */
 	regs->pstate |= (0xf << 6);
 
-	if (loader(arg, regs) < 0)
-		PANIC("failed to load");
+	if (loader(arg, regs) < 0) {
+		WARN("failed to load");
+		exit_task();
+	}
 
 	set_cpu_sysregs(current);
 
@@ -66,6 +72,27 @@ void increment_current_pc(int ilen)
 	regs->pc += ilen;
 }
 
+/* Put @p in the lowest free slot, its index is the pid. */
+static int alloc_task_slot(struct task_struct *p)
+{
+	int pid;
+
+	spin_lock(&task_lock);
+	for (pid = 1; pid < NR_TASKS && task[pid]; pid++)
+		;
+	if (pid == NR_TASKS) {
+		spin_unlock(&task_lock);
+		return -1;
+	}
+	task[pid] = p;
+	if (pid == nr_tasks)
+		nr_tasks++;
+	p->pid = pid;
+	spin_unlock(&task_lock);
+
+	return pid;
+}
+
 int create_task(loader_func_t loader, void *arg)
 {
 	struct task_struct *p;
@@ -76,13 +103,20 @@ int create_task(loader_func_t loader, void *arg)
 	if (!p)
 		return -1;
 
+	int pid = alloc_task_slot(p);
+	if (pid < 0) {
+		deallocate_page(p);
+		return -1;
+	}
+
 	p->cpu_context.x19 = (unsigned long)prepare_task;
 	p->cpu_context.x20 = (unsigned long)loader;
 	p->cpu_context.x21 = (unsigned long)arg;
 	p->flags = 0;
-	p->priority = current->priority;
 	p->state = TASK_RUNNING;
-	p->counter = p->priority;
+	sched_init_task(p);
+	p->mm.fault_around = FAULT_AROUND_PAGES;
+	INIT_LIST_HEAD(&p->mm.balloon_list);
 	(void)strncpy(p->name, "VM", 36);
 
 	p->board_ops = &bcm2837_board_ops;
@@ -94,15 +128,112 @@ int create_task(loader_func_t loader, void *arg)
 
 	p->cpu_context.pc = (unsigned long)switch_from_kthread;
 	p->cpu_context.sp = (unsigned long)childregs;
-	int pid = nr_tasks++;
-	task[pid] = p;
-	p->pid = pid;
 
 	init_task_console(p);
+	activate_task(p);
 
 	return pid;
 }
 
+/* a clone's registers are in place, it goes straight into the VM */
+static void start_clone(void)
+{
+}
+
+/*
+ * Fork @src into a new VM that resumes where @src is. @src is paused while
+ * its vCPU, board state and stage-2 tables are copied, and all of its RAM
+ * ends up shared copy-on-write with the clone. Returns the clone's pid.
+ */
+int clone_task(struct task_struct *src)
+{
+	struct task_struct *p;
+	int pid;
+
+	p = (struct task_struct *)allocate_page();
+	if (!p)
+		return -1;
+
+	if (pause_task(src) < 0) {
+		deallocate_page(p);
+		return -1;
+	}
+
+	pid = alloc_task_slot(p);
+	if (pid < 0) {
+		resume_task(src);
+		deallocate_page(p);
+		return -1;
+	}
+
+	*task_pt_regs(p) = *task_pt_regs(src);
+	p->cpu_sysregs = src->cpu_sysregs;
+	p->cpu_context.x19 = (unsigned long)start_clone;
+	p->cpu_context.pc = (unsigned long)switch_from_kthread;
+	p->cpu_context.sp = (unsigned long)task_pt_regs(p);
+	p->flags = 0;
+	p->state = TASK_RUNNING;
+	sched_init_task(p);
+	p->csched.weight = src->csched.weight;
+	p->csched.cap = src->csched.cap;
+	p->adapt.policy = src->adapt.policy;
+	p->mm.ram_size = src->mm.ram_size;
+	p->mm.fault_around = src->mm.fault_around;
+	p->mm.ksm = src->mm.ksm;
+	p->mm.balloon_target = src->mm.balloon_target;
+	INIT_LIST_HEAD(&p->mm.balloon_list);
+	p->mm.max_pages = src->mm.max_pages;
+	p->mm.max_table_pages = src->mm.max_table_pages;
+	p->mm.oom_policy = src->mm.oom_policy;
+	(void)strncpy(p->name, src->name, 36);
+
+	p->board_ops = src->board_ops;
+	if (HAVE_FUNC(p->board_ops, clone))
+		p->board_ops->clone(p, src);
+
+	init_task_console(p);
+	if (balloon_clone_task(p, src) < 0 || clone_task_mm(p, src) < 0) {
+		resume_task(src);
+		release_task(p);
+		return -1;
+	}
+
+	resume_task(src);
+	activate_task(p);
+
+	INFO("VM %ld cloned to VM %d", src->pid, pid);
+	return pid;
+}
+
+/*
+ * Free everything a killed task holds and recycle its slot. Only called
+ * once the task's context is no longer live on any cpu.
+ */
+void release_task(struct task_struct *p)
+{
+	if (uart_forwarded_task == p->pid)
+		uart_forwarded_task = 0;
+
+	ksm_exit_task(p);
+	balloon_exit_task(p);
+	free_task_mm(p);
+
+	if (HAVE_FUNC(p->board_ops, destroy))
+		p->board_ops->destroy(p);
+
+	destroy_fifo(p->console.in_fifo);
+	destroy_fifo(p->console.out_fifo);
+
+	spin_lock(&task_lock);
+	task[p->pid] = 0;
+	while (nr_tasks > 1 && !task[nr_tasks - 1])
+		nr_tasks--;
+	spin_unlock(&task_lock);
+
+	INFO("VM %ld released", p->pid);
+	deallocate_page(p);
+}
+
 void init_task_console(struct task_struct *tsk)
 {
 	tsk->console.in_fifo = create_fifo();
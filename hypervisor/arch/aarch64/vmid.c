@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "arch/aarch64/vmid.h"
+#include "common/sched.h"
+#include "common/smp.h"
+#include "common/spinlock.h"
+#include "common/utils.h"
+
+/*
+ * VMIDs are handed out lazily when a VM enters, and are only valid in the
+ * generation they were handed out in. A VM whose VMID is of an older
+ * generation gets a new one, keeping the number if it is still free. Once
+ * the numbers run out, the generation rolls over: the TLBs of all VMIDs
+ * are flushed at once and every number is free again, except the ones the
+ * cpus are running, which stay with their VMs.
+ *
+ * A VMID is never given back, so a VM that is torn down leaves its TLB
+ * entries behind; they go with the next rollover, before the number can
+ * be used again. VMID 0 is never handed out.
+ */
+
+static DEFINE_SPINLOCK(vmid_lock);
+static unsigned long vmid_generation = VMID_FIRST_GENERATION;
+static unsigned long vmid_map[VMID_NR / 64];
+static unsigned long cur_idx = 1;
+
+/* written with vmid_lock held */
+static unsigned long active_vmids[NR_CPUS]; // running on the cpu
+static unsigned long reserved_vmids[NR_CPUS]; // kept over a rollover
+
+static inline bool vmid_is_current(unsigned long vmid)
+{
+	return !((vmid ^ vmid_generation) >> VMID_BITS);
+}
+
+static inline int test_and_set_vmid(unsigned long idx)
+{
+	unsigned long bit = 1UL << (idx % 64);
+	int old = !!(vmid_map[idx / 64] & bit);
+
+	vmid_map[idx / 64] |= bit;
+	return old;
+}
+
+static unsigned long find_free_vmid(unsigned long from)
+{
+	unsigned long idx;
+
+	for (idx = from; idx < VMID_NR; idx++) {
+		if (!(vmid_map[idx / 64] & (1UL << (idx % 64))))
+			return idx;
+	}
+
+	return 0;
+}
+
+static void rollover_vmids(void)
+{
+	unsigned long vmid;
+	int cpu;
+
+	vmid_generation += VMID_NR;
+	memzero(vmid_map, sizeof(vmid_map));
+	test_and_set_vmid(0);
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		vmid = active_vmids[cpu];
+		active_vmids[cpu] = 0;
+		if (!vmid)
+			vmid = reserved_vmids[cpu];
+		test_and_set_vmid(vmid & VMID_MASK);
+		reserved_vmids[cpu] = vmid;
+	}
+
+	flush_stage2_tlb();
+	cur_idx = 1;
+}
+
+/* The VMID a cpu kept over the rollover goes back to its VM. */
+static bool update_reserved_vmid(unsigned long vmid, unsigned long newvmid)
+{
+	bool hit = false;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (reserved_vmids[cpu] == vmid) {
+			reserved_vmids[cpu] = newvmid;
+			hit = true;
+		}
+	}
+
+	return hit;
+}
+
+/* Called with vmid_lock held. */
+static unsigned long new_vmid(struct task_struct *p)
+{
+	unsigned long vmid = p->mm.vmid, newvmid, idx;
+
+	if (vmid) {
+		newvmid = vmid_generation | (vmid & VMID_MASK);
+		if (update_reserved_vmid(vmid, newvmid))
+			return newvmid;
+		if (!test_and_set_vmid(vmid & VMID_MASK))
+			return newvmid;
+	}
+
+	idx = find_free_vmid(cur_idx);
+	if (!idx) {
+		rollover_vmids();
+		idx = find_free_vmid(cur_idx);
+	}
+
+	test_and_set_vmid(idx);
+	cur_idx = idx;
+	return vmid_generation | idx;
+}
+
+/*
+ * Make sure the VM about to enter on this cpu has a VMID of the current
+ * generation, and return it for VTTBR_EL2.
+ */
+unsigned long update_vmid(struct task_struct *p)
+{
+	int cpu = smp_processor_id();
+	unsigned long vmid = p->mm.vmid;
+
+	if (vmid_is_current(vmid) && active_vmids[cpu] == vmid)
+		return vmid;
+
+	spin_lock(&vmid_lock);
+	vmid = p->mm.vmid;
+	if (!vmid_is_current(vmid)) {
+		vmid = new_vmid(p);
+		p->mm.vmid = vmid;
+	}
+	active_vmids[cpu] = vmid;
+	spin_unlock(&vmid_lock);
+
+	return vmid;
+}
+
+/*
+ * A VM running on another cpu keeps the VMID of an older generation over a
+ * rollover until it enters again, and its entries are refilled meanwhile,
+ * so flush by the number whatever the generation. If the number was handed
+ * out again since, its new owner loses some entries as well.
+ */
+void flush_task_tlb(struct task_struct *p)
+{
+	unsigned long vmid = p->mm.vmid;
+
+	if (vmid)
+		flush_vmid_tlb(vmid & VMID_MASK);
+}
+
+void flush_task_ipa_tlb(struct task_struct *p, unsigned long ipa)
+{
+	unsigned long vmid = p->mm.vmid;
+
+	if (vmid)
+		flush_ipa_tlb(vmid & VMID_MASK, ipa);
+}
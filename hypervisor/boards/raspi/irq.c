@@ -13,6 +13,7 @@
 #include "common/entry.h"
 #include "common/mini_uart.h"
 #include "common/sched.h"
+#include "common/smp.h"
 #include "common/timer.h"
 #include "common/utils.h"
 
@@ -40,6 +41,23 @@ void enable_interrupt_controller()
 	put32(ENABLE_IRQS_1, AUX_IRQ_BIT);
 }
 
+/* mailbox 0 of each core is used as the reschedule IPI */
+void enable_ipi(void)
+{
+	put32(CORE_MBOX_IRQCNTL(smp_processor_id()), CORE_MBOX0_IRQ);
+}
+
+void send_ipi(int cpu)
+{
+	put32(CORE_MBOX_SET(cpu, 0), 1);
+}
+
+static void handle_ipi(int cpu)
+{
+	/* the work is done by check_preempt() on the way out */
+	put32(CORE_MBOX_RDCLR(cpu, 0), get32(CORE_MBOX_RDCLR(cpu, 0)));
+}
+
 void show_invalid_entry_message(int type, unsigned long esr, unsigned long elr,
 				unsigned long far)
 {
@@ -47,7 +65,7 @@ void show_invalid_entry_message(int type, unsigned long esr, unsigned long elr,
 	      entry_error_messages[type], esr, elr, far);
 }
 
-void handle_irq(void)
+static void handle_gpu_irq(void)
 {
 	unsigned int irq = get32(IRQ_PENDING_1);
 	if (irq & SYSTEM_TIMER_IRQ_1_BIT) {
@@ -68,3 +86,22 @@ void handle_irq(void)
 	if (irq)
 		WARN("unknown pending irq: %x", irq);
 }
+
+void handle_irq(void)
+{
+	int cpu = smp_processor_id();
+	unsigned int source = get32(CORE_IRQ_SOURCE(cpu));
+
+	if (source & CORE_IRQ_MBOX0)
+		handle_ipi(cpu);
+
+	if (source & CORE_IRQ_CNTHP)
+		handle_local_timer_irq();
+
+	/* peripheral interrupts are only routed to cpu 0 */
+	if (source & CORE_IRQ_GPU)
+		handle_gpu_irq();
+
+	/* the interrupt may have woken or boosted a VM */
+	check_preempt();
+}
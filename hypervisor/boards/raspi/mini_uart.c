@@ -60,7 +60,7 @@ void handle_uart_irq(void)
 			is_escaped = 0;
 			if (isdigit(received)) {
 				tsk_id = received - '0';
-				if (tsk_id > nr_tasks - 1)
+				if (tsk_id > nr_tasks - 1 || !task[tsk_id])
 					goto clear_int;
 				uart_forwarded_task = tsk_id;
 				printf("\nSwitched to console: %d\n",
@@ -78,8 +78,10 @@ void handle_uart_irq(void)
 		} else {
 enqueue_char:
 			tsk = task[uart_forwarded_task];
-			if (tsk->state == TASK_RUNNING)
+			if (tsk && tsk->state != TASK_ZOMBIE) {
 				enqueue_fifo(tsk->console.in_fifo, received);
+				wake_up_task(tsk);
+			}
 		}
 	}
 
@@ -17,7 +17,6 @@ static struct page_pool rasp3b_page_pool = {
 	.start_addr = LOW_MEMORY,
 	.page_nr = PAGING_PAGES,
 	.memap = rasp3b_page_memap,
-	.last_page_id = 0,
 };
 
 struct page_pool *get_rasp3b_page_pool(void)
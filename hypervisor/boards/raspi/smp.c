@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "common/smp.h"
+#include "common/debug.h"
+#include "common/delays.h"
+#include "common/irq.h"
+#include "common/mm.h"
+#include "common/spinlock.h"
+#include "common/utils.h"
+
+/* QEMU holds the secondaries in the firmware spin table below the image */
+#define SPIN_TABLE_BASE 0xd8
+
+#define ALL_CPUS_MASK ((1UL << NR_CPUS) - 1)
+
+extern unsigned long secondary_release;
+extern char _start[];
+
+volatile unsigned long cpu_online_mask = 1;
+static DEFINE_SPINLOCK(cpu_online_lock);
+
+void set_cpu_online(int cpu)
+{
+	spin_lock(&cpu_online_lock);
+	cpu_online_mask |= 1UL << cpu;
+	spin_unlock(&cpu_online_lock);
+}
+
+void smp_init(void)
+{
+	/*
+	 * With kernel_old=1 the image sits at 0x0 and every cpu enters
+	 * _start, where the secondaries wait for secondary_release.
+	 * Otherwise they spin in the spin table and must be pointed at it.
+	 */
+	if ((unsigned long)_start != 0) {
+		for (int cpu = 1; cpu < NR_CPUS; cpu++) {
+			unsigned long *entry = (unsigned long *)TO_VADDR(
+				SPIN_TABLE_BASE + cpu * 8);
+
+			*(volatile unsigned long *)entry =
+				(unsigned long)_start;
+			dcache_clean_inval_range(entry, sizeof(*entry));
+		}
+	}
+
+	/*
+	 * The secondaries read both words with their caches off, so push
+	 * them to memory before the event wakes them up.
+	 */
+	secondary_release = 1;
+	dcache_clean_inval_range(&secondary_release, sizeof(secondary_release));
+	send_event();
+
+	for (int i = 0; i < 100 && cpu_online_mask != ALL_CPUS_MASK; i++)
+		wait_msec(1000);
+
+	if (cpu_online_mask != ALL_CPUS_MASK)
+		WARN("cpus online: %x", cpu_online_mask);
+}
+
+void smp_send_reschedule(int cpu)
+{
+	send_ipi(cpu);
+}
@@ -8,26 +8,96 @@
  */
 
 #include "boards/raspi/timer.h"
+#include "arch/aarch64/sysregs.h"
+#include "arch/aarch64/timer.h"
+#include "boards/raspi/irq.h"
 #include "common/board.h"
 #include "common/debug.h"
 #include "common/sched.h"
+#include "common/smp.h"
+#include "common/timer.h"
 #include "common/utils.h"
 
-const unsigned int interval = 400000;
+/*
+ * The scheduler timer is one-shot: it is only programmed for the next
+ * event the scheduler asks for (see sched_update_timer()). The system
+ * timer only interrupts cpu 0, which uses compare 1; the other cpus use
+ * the EL2 physical timer (CNTHP).
+ */
+#define TIMER_MIN_DELTA 10 // microseconds
+#define TIMER_MAX_DELTA 100000000 // keeps CNTHP_TVAL within 32 bits
+
+static void set_c1_event(unsigned long deadline)
+{
+	unsigned long now = get_physical_timer_count();
+
+	/* nothing to wait for: the next match is a full wrap away */
+	if (!deadline) {
+		put32(TIMER_C1, (unsigned int)now - 1);
+		return;
+	}
+
+	if (deadline < now + TIMER_MIN_DELTA)
+		deadline = now + TIMER_MIN_DELTA;
+	put32(TIMER_C1, deadline);
+
+	/* the counter may have passed the compare while it was written */
+	if ((int)(get32(TIMER_CLO) - (unsigned int)deadline) >= 0)
+		put32(TIMER_C1, get32(TIMER_CLO) + TIMER_MIN_DELTA);
+}
+
+static void set_cnthp_event(unsigned long deadline)
+{
+	unsigned long now = get_physical_timer_count();
+	unsigned long delta;
+
+	if (!deadline) {
+		WRITE_SYSREG(0, cnthp_ctl_el2);
+		return;
+	}
+
+	delta = deadline > now + TIMER_MIN_DELTA ? deadline - now :
+						   TIMER_MIN_DELTA;
+	delta = MIN(delta, TIMER_MAX_DELTA);
+
+	WRITE_SYSREG(arm64_cntfrq() * delta / 1000000, cnthp_tval_el2);
+	WRITE_SYSREG(1, cnthp_ctl_el2);
+}
+
+/* fire the scheduler timer at physical count @deadline, 0 for never */
+void timer_set_next_event(unsigned long deadline)
+{
+	if (smp_processor_id() == 0)
+		set_c1_event(deadline);
+	else
+		set_cnthp_event(deadline);
+}
 
 void timer_init(void)
 {
-	put32(TIMER_C1, get32(TIMER_CLO) + interval);
+	set_c1_event(0);
 }
 
 /* for task switch */
 void handle_timer1_irq(void)
 {
-	put32(TIMER_C1, get32(TIMER_CLO) + interval);
 	put32(TIMER_CS, TIMER_CS_M1);
 	timer_tick();
 }
 
+void local_timer_init(void)
+{
+	set_cnthp_event(0);
+	put32(CORE_TIMER_IRQCNTL(smp_processor_id()), CORE_TIMER_CNTHP_IRQ);
+}
+
+void handle_local_timer_irq(void)
+{
+	/* the timer keeps asserting until it is reprogrammed */
+	WRITE_SYSREG(0, cnthp_ctl_el2);
+	timer_tick();
+}
+
 /* for vm's interrupt */
 void handle_timer3_irq(void)
 {
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "common/balloon.h"
+#include "common/list.h"
+#include "common/sched.h"
+#include "common/slab.h"
+
+/*
+ * Memory balloon. The shell sets how many pages a VM should give back.
+ * The VM's driver polls the target with HVC_BALLOON_TARGET and hands pages
+ * over one at a time, which are unmapped and freed here. Pages it takes
+ * back later fault in again like any other.
+ *
+ * Only the VM itself changes its balloon, from its hypercalls, so the
+ * list needs no lock.
+ */
+
+struct balloon_page {
+	struct list_head list; // on mm.balloon_list
+	vaddr_t ipa;
+};
+
+static struct kmem_cache balloon_page_cache = KMEM_CACHE_INIT(
+	balloon_page_cache, "balloon_page", sizeof(struct balloon_page));
+
+static struct balloon_page *find_balloon_page(struct task_struct *p,
+					      vaddr_t ipa)
+{
+	struct list_head *pos;
+
+	list_for_each(pos, &p->mm.balloon_list) {
+		struct balloon_page *bp =
+			list_entry(pos, struct balloon_page, list);
+		if (bp->ipa == ipa)
+			return bp;
+	}
+
+	return NULL;
+}
+
+int balloon_set_target(struct task_struct *p, unsigned long pages)
+{
+	unsigned long ram = p->mm.ram_size ? p->mm.ram_size : HIGH_MEMORY;
+
+	if (pages > ram / PAGE_SIZE)
+		return -1;
+
+	p->mm.balloon_target = pages;
+	return 0;
+}
+
+/* Only a page that the VM has and that is not in the balloon yet counts. */
+long balloon_inflate(struct task_struct *p, vaddr_t ipa)
+{
+	struct balloon_page *bp;
+
+	if ((ipa & ~PAGE_MASK) || ipa >= HIGH_MEMORY ||
+	    (p->mm.ram_size && ipa >= p->mm.ram_size))
+		return -1;
+
+	if (p->mm.balloon_pages >= p->mm.balloon_target ||
+	    find_balloon_page(p, ipa))
+		return -1;
+
+	bp = kmem_cache_alloc(&balloon_page_cache, ALLOC_TRY);
+	if (!bp)
+		return -1;
+
+	if (unmap_task_page(p, ipa) <= 0) {
+		kmem_cache_free(&balloon_page_cache, bp);
+		return -1;
+	}
+
+	bp->ipa = ipa;
+	list_add_tail(&bp->list, &p->mm.balloon_list);
+	p->mm.balloon_pages++;
+	return 0;
+}
+
+long balloon_deflate(struct task_struct *p, vaddr_t ipa)
+{
+	struct balloon_page *bp = find_balloon_page(p, ipa);
+
+	if (!bp)
+		return -1;
+
+	list_del(&bp->list);
+	kmem_cache_free(&balloon_page_cache, bp);
+	p->mm.balloon_pages--;
+	return 0;
+}
+
+/* Give the clone dst the balloon of src, which holds still meanwhile. */
+int balloon_clone_task(struct task_struct *dst, struct task_struct *src)
+{
+	struct list_head *pos;
+	struct balloon_page *bp;
+
+	list_for_each(pos, &src->mm.balloon_list) {
+		bp = kmem_cache_alloc(&balloon_page_cache, ALLOC_TRY);
+		if (!bp)
+			return -1;
+		bp->ipa = list_entry(pos, struct balloon_page, list)->ipa;
+		list_add_tail(&bp->list, &dst->mm.balloon_list);
+		dst->mm.balloon_pages++;
+	}
+
+	return 0;
+}
+
+void balloon_exit_task(struct task_struct *p)
+{
+	struct list_head *pos, *n;
+
+	list_for_each_safe(pos, n, &p->mm.balloon_list) {
+		list_del(pos);
+		kmem_cache_free(&balloon_page_cache,
+				list_entry(pos, struct balloon_page, list));
+	}
+	p->mm.balloon_pages = 0;
+}
@@ -8,17 +8,22 @@
  */
 
 #include "common/fifo.h"
-#include "common/mm.h"
+#include "common/slab.h"
+#include "common/spinlock.h"
 
-#define FIFO_SIZE 256 // warning: DO NOT exceed page size
+#define FIFO_SIZE 256 // warning: DO NOT exceed KMALLOC_MAX_SIZE
 
 struct fifo {
+	spinlock_t lock; // the console is fed and drained from different cpus
 	unsigned int head;
 	unsigned int tail;
 	unsigned int used;
 	unsigned long buf[FIFO_SIZE];
 };
 
+static struct kmem_cache fifo_cache =
+	KMEM_CACHE_INIT(fifo_cache, "fifo", sizeof(struct fifo));
+
 #define NEXT_INDEX(i) (((i) + 1) == FIFO_SIZE ? 0 : ((i) + 1))
 
 int is_empty_fifo(struct fifo *fifo)
@@ -33,7 +38,8 @@ int is_full_fifo(struct fifo *fifo)
 
 struct fifo *create_fifo()
 {
-	struct fifo *fifo = (struct fifo *)allocate_page();
+	struct fifo *fifo = kmem_cache_alloc(&fifo_cache, ALLOC_NOZERO);
+	spin_lock_init(&fifo->lock);
 	fifo->head = 0;
 	fifo->tail = 0;
 	fifo->used = 0;
@@ -41,29 +47,45 @@ struct fifo *create_fifo()
 	return fifo;
 }
 
+void destroy_fifo(struct fifo *fifo)
+{
+	kmem_cache_free(&fifo_cache, fifo);
+}
+
 void clear_fifo(struct fifo *fifo)
 {
+	spin_lock(&fifo->lock);
 	fifo->head = 0;
 	fifo->tail = 0;
 	fifo->used = 0;
+	spin_unlock(&fifo->lock);
 }
 
 int enqueue_fifo(struct fifo *fifo, unsigned long val)
 {
-	if (is_full_fifo(fifo))
+	spin_lock(&fifo->lock);
+
+	if (is_full_fifo(fifo)) {
+		spin_unlock(&fifo->lock);
 		return -1;
+	}
 
 	fifo->buf[fifo->head] = val;
 	fifo->head = NEXT_INDEX(fifo->head);
 	fifo->used++;
 
+	spin_unlock(&fifo->lock);
 	return 0;
 }
 
 int dequeue_fifo(struct fifo *fifo, unsigned long *val)
 {
-	if (is_empty_fifo(fifo))
+	spin_lock(&fifo->lock);
+
+	if (is_empty_fifo(fifo)) {
+		spin_unlock(&fifo->lock);
 		return -1;
+	}
 
 	if (val)
 		*val = fifo->buf[fifo->tail];
@@ -71,6 +93,7 @@ int dequeue_fifo(struct fifo *fifo, unsigned long *val)
 	fifo->tail = NEXT_INDEX(fifo->tail);
 	fifo->used--;
 
+	spin_unlock(&fifo->lock);
 	return 0;
 }
 
@@ -0,0 +1,526 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "common/ksm.h"
+#include "arch/aarch64/mmu.h"
+#include "common/list.h"
+#include "common/printf.h"
+#include "common/sched.h"
+#include "common/slab.h"
+#include "common/spinlock.h"
+#include "common/timer.h"
+#include "common/utils.h"
+
+/*
+ * Same-page merging. Idle cpus hash the RAM of the VMs that opted in, one
+ * page at a time. A page with the contents of a shared page is remapped to
+ * it read-only and freed, and a page that matches one seen earlier in the
+ * pass becomes shared with it. A write to a shared page takes a stage-2
+ * permission fault and gets a private copy.
+ *
+ * Locking order: ksm_lock, then the mm lock of a VM, then the page pool.
+ */
+
+#define KSM_HASH_SIZE	   1024 // buckets of the stable tables
+#define KSM_UNSTABLE_ORDER 5 // candidate table, cleared every pass
+#define KSM_UNSTABLE_SIZE \
+	((PAGE_SIZE << KSM_UNSTABLE_ORDER) / sizeof(struct ksm_rmap))
+#define KSM_SCAN_STEPS 512 // entries looked at per call, hashed or not
+
+/* a page mapped read-only by several stage-2 entries */
+struct ksm_item {
+	struct list_head hash_list; // on stable_hash, by contents
+	struct list_head pa_list; // on stable_pa, by address
+	paddr_t pa;
+	uint32_t hash;
+	uint32_t refs; // stage-2 entries that map it
+};
+
+/* a private page seen earlier in this pass */
+struct ksm_rmap {
+	vaddr_t ipa;
+	uint32_t hash;
+	int32_t pid; // 0 if the slot is free
+};
+
+struct ksm_stat {
+	unsigned long pages_shared; // pages in the stable tables
+	unsigned long pages_sharing; // mappings beyond the first, pages saved
+	unsigned long zero_pages; // pages merged into the zero page
+	unsigned long cow_breaks;
+	unsigned long full_scans;
+};
+
+static DEFINE_SPINLOCK(ksm_lock);
+static struct list_head stable_hash[KSM_HASH_SIZE];
+static struct list_head stable_pa[KSM_HASH_SIZE];
+static struct ksm_rmap *unstable;
+static struct kmem_cache ksm_item_cache =
+	KMEM_CACHE_INIT(ksm_item_cache, "ksm_item", sizeof(struct ksm_item));
+static struct ksm_stat ksm_stat;
+static uint32_t zero_hash;
+
+/* scanner position */
+static int scan_pid = 1;
+static vaddr_t scan_ipa;
+static unsigned long next_pass; // physical count to start the next pass at
+
+static uint32_t hash_page(paddr_t pa)
+{
+	const uint64_t *p = (const uint64_t *)TO_VADDR(pa);
+	uint64_t h = 0xcbf29ce484222325;
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / 8; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3;
+	}
+
+	return h ^ (h >> 32);
+}
+
+static bool same_page(paddr_t a, paddr_t b)
+{
+	const uint64_t *p = (const uint64_t *)TO_VADDR(a);
+	const uint64_t *q = (const uint64_t *)TO_VADDR(b);
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / 8; i++) {
+		if (p[i] != q[i])
+			return false;
+	}
+
+	return true;
+}
+
+void ksm_init(void)
+{
+	int i;
+
+	for (i = 0; i < KSM_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&stable_hash[i]);
+		INIT_LIST_HEAD(&stable_pa[i]);
+	}
+	unstable = allocate_pages(KSM_UNSTABLE_ORDER, 0);
+	zero_hash = hash_page(empty_zero_page);
+}
+
+static struct ksm_item *alloc_item(void)
+{
+	return kmem_cache_alloc(&ksm_item_cache, ALLOC_TRY);
+}
+
+static inline struct list_head *pa_bucket(paddr_t pa)
+{
+	return &stable_pa[(pa >> PAGE_SHIFT) % KSM_HASH_SIZE];
+}
+
+static struct ksm_item *find_by_pa(paddr_t pa)
+{
+	struct list_head *pos, *head = pa_bucket(pa);
+	struct ksm_item *item;
+
+	list_for_each(pos, head) {
+		item = list_entry(pos, struct ksm_item, pa_list);
+		if (item->pa == pa)
+			return item;
+	}
+
+	return NULL;
+}
+
+static struct ksm_item *find_by_contents(uint32_t hash, paddr_t pa)
+{
+	struct list_head *pos, *head = &stable_hash[hash % KSM_HASH_SIZE];
+	struct ksm_item *item;
+
+	list_for_each(pos, head) {
+		item = list_entry(pos, struct ksm_item, hash_list);
+		if (item->hash == hash && same_page(item->pa, pa))
+			return item;
+	}
+
+	return NULL;
+}
+
+static void insert_item(struct ksm_item *item)
+{
+	list_add(&item->hash_list, &stable_hash[item->hash % KSM_HASH_SIZE]);
+	list_add(&item->pa_list, pa_bucket(item->pa));
+	ksm_stat.pages_shared++;
+}
+
+/* Forget a shared page, its last mapping keeps the page. */
+static void remove_item(struct ksm_item *item)
+{
+	list_del(&item->hash_list);
+	list_del(&item->pa_list);
+	ksm_stat.pages_shared--;
+	kmem_cache_free(&ksm_item_cache, item);
+}
+
+static void put_item(struct ksm_item *item)
+{
+	if (--item->refs) {
+		ksm_stat.pages_sharing--;
+		return;
+	}
+
+	deallocate_page((void *)TO_VADDR(item->pa));
+	remove_item(item);
+}
+
+static void lock_mm_pair(struct task_struct *a, struct task_struct *b)
+{
+	if (a == b) {
+		spin_lock(&a->mm.lock);
+	} else if (a->pid < b->pid) {
+		spin_lock(&a->mm.lock);
+		spin_lock(&b->mm.lock);
+	} else {
+		spin_lock(&b->mm.lock);
+		spin_lock(&a->mm.lock);
+	}
+}
+
+static void unlock_mm_pair(struct task_struct *a, struct task_struct *b)
+{
+	spin_unlock(&a->mm.lock);
+	if (a != b)
+		spin_unlock(&b->mm.lock);
+}
+
+/*
+ * Map the page at ipa to a shared page with the same contents, called with
+ * the VM's mm lock held. The page is write-protected before the contents
+ * are compared, so the VM cannot change it in between.
+ */
+static int merge_into(struct task_struct *p, vaddr_t ipa, paddr_t shared)
+{
+	paddr_t pa = stage2_wrprotect_page(p, ipa);
+
+	if (!pa)
+		return -1;
+
+	if (!same_page(pa, shared)) {
+		stage2_make_writable(p, ipa);
+		return -1;
+	}
+
+	stage2_replace_page(p, ipa, shared, MMU_STAGE2_RO_PAGE_FLAGS);
+	deallocate_page((void *)TO_VADDR(pa));
+	return 0;
+}
+
+static void merge_with_item(struct task_struct *p, vaddr_t ipa,
+			    struct ksm_item *item)
+{
+	spin_lock(&p->mm.lock);
+	if (merge_into(p, ipa, item->pa) == 0) {
+		item->refs++;
+		ksm_stat.pages_sharing++;
+	}
+	spin_unlock(&p->mm.lock);
+}
+
+/* Zero-filled pages go to the zero page, which needs no refcount. */
+static int merge_with_zero(struct task_struct *p, vaddr_t ipa)
+{
+	int ret;
+
+	spin_lock(&p->mm.lock);
+	ret = merge_into(p, ipa, empty_zero_page);
+	if (ret == 0) {
+		p->mm.user_pages_count--;
+		ksm_stat.zero_pages++;
+	}
+	spin_unlock(&p->mm.lock);
+
+	return ret;
+}
+
+/* Share the page of q at qipa with p at pipa if they still match. */
+static int merge_pages(struct task_struct *q, vaddr_t qipa,
+		       struct task_struct *p, vaddr_t pipa)
+{
+	struct ksm_item *item = NULL;
+	paddr_t qpa, ppa;
+
+	lock_mm_pair(q, p);
+
+	qpa = stage2_wrprotect_page(q, qipa);
+	ppa = stage2_wrprotect_page(p, pipa);
+	if (qpa && ppa && same_page(qpa, ppa))
+		item = alloc_item();
+
+	if (!item) {
+		if (qpa)
+			stage2_make_writable(q, qipa);
+		if (ppa)
+			stage2_make_writable(p, pipa);
+		unlock_mm_pair(q, p);
+		return -1;
+	}
+
+	item->pa = qpa;
+	item->hash = hash_page(qpa);
+	item->refs = 2;
+	insert_item(item);
+	ksm_stat.pages_sharing++;
+
+	stage2_replace_page(p, pipa, qpa, MMU_STAGE2_RO_PAGE_FLAGS);
+	deallocate_page((void *)TO_VADDR(ppa));
+
+	unlock_mm_pair(q, p);
+	return 0;
+}
+
+/*
+ * Look the page up among the shared pages, then among the pages seen in
+ * this pass. A page that matches neither is remembered for the rest of
+ * the pass; candidates whose VM went away or changed are caught by the
+ * compare in merge_pages().
+ */
+static void merge_page(struct task_struct *p, vaddr_t ipa, paddr_t pa)
+{
+	uint32_t hash = hash_page(pa);
+	struct ksm_item *item;
+	struct ksm_rmap *rmap;
+	struct task_struct *q;
+
+	if (hash == zero_hash && merge_with_zero(p, ipa) == 0)
+		return;
+
+	item = find_by_contents(hash, pa);
+	if (item) {
+		merge_with_item(p, ipa, item);
+		return;
+	}
+
+	rmap = &unstable[hash % KSM_UNSTABLE_SIZE];
+	if (rmap->pid && rmap->hash == hash &&
+	    (rmap->pid != p->pid || rmap->ipa != ipa)) {
+		q = task[rmap->pid];
+		if (q && q->mm.ksm && q->state != TASK_ZOMBIE &&
+		    merge_pages(q, rmap->ipa, p, ipa) == 0) {
+			rmap->pid = 0;
+			return;
+		}
+	}
+
+	rmap->ipa = ipa;
+	rmap->hash = hash;
+	rmap->pid = p->pid;
+}
+
+/*
+ * Hash one page of private RAM, merging it if it can be. Called by idle
+ * cpus, returns 0 if there was nothing to do until the next pass.
+ */
+int ksm_scan_page(void)
+{
+	unsigned long now = get_physical_timer_count();
+	struct task_struct *p;
+	vaddr_t ipa, next, end;
+	paddr_t pa;
+	int steps = 0, scanned = 0;
+
+	if (!unstable || now < next_pass)
+		return 0;
+
+	spin_lock(&ksm_lock);
+
+	while (!scanned && scan_pid < nr_tasks && steps++ < KSM_SCAN_STEPS) {
+		p = task[scan_pid];
+		end = 0;
+		if (p && p->mm.ksm && p->state != TASK_ZOMBIE)
+			end = p->mm.ram_size ? p->mm.ram_size : HIGH_MEMORY;
+		if (scan_ipa >= end) {
+			scan_pid++;
+			scan_ipa = 0;
+			continue;
+		}
+
+		spin_lock(&p->mm.lock);
+		pa = stage2_private_page(p, scan_ipa, &next);
+		spin_unlock(&p->mm.lock);
+
+		ipa = scan_ipa;
+		scan_ipa = next;
+		if (pa) {
+			merge_page(p, ipa, pa);
+			scanned = 1;
+		}
+	}
+
+	if (scan_pid >= nr_tasks) {
+		scan_pid = 1;
+		scan_ipa = 0;
+		memzero(unstable, PAGE_SIZE << KSM_UNSTABLE_ORDER);
+		ksm_stat.full_scans++;
+		next_pass = now + KSM_PASS_INTERVAL;
+	}
+
+	spin_unlock(&ksm_lock);
+
+	return 1;
+}
+
+/*
+ * Give the VM a private, writable copy of the shared page at ipa, splitting
+ * the block a clone shares there first. The last mapping of a shared page
+ * just takes it over. Returns -1 if the pool has no page for the copy or
+ * the table.
+ */
+int ksm_break_cow(struct task_struct *p, vaddr_t ipa)
+{
+	struct ksm_item *item;
+	paddr_t pa;
+	void *copy;
+	int ret = 0;
+
+	ipa &= PAGE_MASK;
+
+	spin_lock(&ksm_lock);
+	spin_lock(&p->mm.lock);
+
+	if (stage2_split_shared_block(p, ipa) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	pa = stage2_readonly_page(p, ipa);
+	if (!pa || pa == empty_zero_page)
+		goto out; // a stale TLB entry, or broken already
+
+	item = find_by_pa(pa);
+	if (!item || item->refs == 1) {
+		if (item)
+			remove_item(item);
+		stage2_make_writable(p, ipa);
+		goto out;
+	}
+
+	/* already counted against the VM while it was shared */
+	copy = allocate_pages(0, ALLOC_NOZERO | ALLOC_TRY);
+	if (!copy) {
+		ret = -1;
+		goto out;
+	}
+
+	memcpy(copy, (void *)TO_VADDR(pa), PAGE_SIZE);
+	dcache_clean_inval_range(copy, PAGE_SIZE);
+	stage2_replace_page(p, ipa, TO_PADDR(copy), MMU_STAGE2_PAGE_FLAGS);
+	put_item(item);
+	ksm_stat.cow_breaks++;
+
+out:
+	spin_unlock(&p->mm.lock);
+	spin_unlock(&ksm_lock);
+	return ret;
+}
+
+/*
+ * Cloning a VM shares its pages through the same refcounts. The clone
+ * holds ksm_lock across the whole copy, see clone_task_mm().
+ */
+void ksm_lock_pages(void)
+{
+	spin_lock(&ksm_lock);
+}
+
+void ksm_unlock_pages(void)
+{
+	spin_unlock(&ksm_lock);
+}
+
+/*
+ * Add a mapping to a page, which becomes shared if it was private. Pages
+ * shared this way are not hashed, so the scanner never merges other pages
+ * into them, they are only found by address. Called with ksm_lock held.
+ */
+int __ksm_share_page(paddr_t pa)
+{
+	struct ksm_item *item = find_by_pa(pa);
+
+	if (!item) {
+		item = alloc_item();
+		if (!item)
+			return -1;
+		item->pa = pa;
+		item->refs = 1;
+		INIT_LIST_HEAD(&item->hash_list);
+		list_add(&item->pa_list, pa_bucket(pa));
+		ksm_stat.pages_shared++;
+	}
+
+	item->refs++;
+	ksm_stat.pages_sharing++;
+	return 0;
+}
+
+/*
+ * Take back a mapping __ksm_share_page() added, for a clone that could not
+ * share a whole block. private says the page was private before, and its
+ * item goes again. Called with ksm_lock held.
+ */
+void __ksm_unshare_page(paddr_t pa, bool private)
+{
+	struct ksm_item *item = find_by_pa(pa);
+
+	if (private) {
+		ksm_stat.pages_sharing--;
+		remove_item(item);
+	} else {
+		put_item(item);
+	}
+}
+
+/* Drop a mapping of a shared page, for a VM that is going away. */
+void ksm_put_page(paddr_t pa)
+{
+	struct ksm_item *item;
+
+	spin_lock(&ksm_lock);
+	item = find_by_pa(pa);
+	if (item)
+		put_item(item);
+	else
+		deallocate_page((void *)TO_VADDR(pa));
+	spin_unlock(&ksm_lock);
+}
+
+void ksm_set_task(struct task_struct *p, int on)
+{
+	p->mm.ksm = !!on;
+}
+
+/*
+ * Called for a zombie before its memory goes. The scanner skips zombies,
+ * so once it is done with the page it may be on, it leaves @p alone.
+ */
+void ksm_exit_task(struct task_struct *p)
+{
+	spin_lock(&ksm_lock);
+	spin_unlock(&ksm_lock);
+}
+
+void show_ksm_stat(void)
+{
+	struct ksm_stat stat;
+
+	spin_lock(&ksm_lock);
+	stat = ksm_stat;
+	spin_unlock(&ksm_lock);
+
+	printf("ksm: %lu pages shared, %lu pages saved, %lu pages zeroed, "
+	       "%lu cow breaks, %lu full scans\n",
+	       stat.pages_shared, stat.pages_sharing, stat.zero_pages,
+	       stat.cow_breaks, stat.full_scans);
+}
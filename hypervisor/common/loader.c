@@ -9,52 +9,111 @@
 
 #include <inttypes.h>
 
+#include "arch/aarch64/mmu.h"
 #include "common/debug.h"
 #include "common/loader.h"
 #include "common/mm.h"
 #include "common/sched.h"
+#include "common/slab.h"
+#include "common/spinlock.h"
 #include "common/utils.h"
 #include "fs/ff.h"
 
-// va should be page-aligned.
+/* FatFs and the SD driver are not reentrant */
+DEFINE_SPINLOCK(fs_lock);
+
+/*
+ * va should be page-aligned. The image goes into 2 MiB blocks while the
+ * pool has them and they fit in the VM's RAM, padded with zeroes to the
+ * block boundaries, and into pages otherwise. A 2 MiB range that already
+ * has something mapped in it is loaded page by page.
+ */
 int load_file_to_memory(struct task_struct *tsk, const char *name,
 			unsigned long va)
 {
 	unsigned long gva = va & PAGE_MASK;
+	unsigned long base, off, size, pages_until = 0;
 	uint8_t *buf;
+	int order;
 	FRESULT r;
 	UINT br;
 	FIL f;
 
+	spin_lock(&fs_lock);
+
 	r = f_open(&f, name, FA_READ);
 	if (r) {
+		spin_unlock(&fs_lock);
 		PANIC("Can't open the file: %s, err=%d\n", name, r);
 		return -r;
 	}
 
 	for (;;) {
-		buf = allocate_task_page(tsk, gva);
-		r = f_read(&f, buf, PAGE_SIZE, &br);
+		order = STAGE2_BLOCK_ORDER;
+		base = gva & SECTION_MASK;
+		size = SECTION_SIZE;
+		buf = 0;
+		if (gva >= pages_until &&
+		    (!tsk->mm.ram_size || base + size <= tsk->mm.ram_size))
+			buf = allocate_pages(order, ALLOC_NOZERO);
+		if (!buf) {
+			order = 0;
+			base = gva;
+			size = PAGE_SIZE;
+			buf = allocate_pages(order, ALLOC_NOZERO);
+		}
+
+		off = gva - base;
+		r = f_read(&f, buf + off, size - off, &br);
 		if (br == 0) { /* error or eof */
-			deallocate_page(buf);
+			deallocate_pages(buf, order);
 			break;
 		}
-		gva += PAGE_SIZE;
+		memzero(buf, off);
+		memzero(buf + off + br, size - off - br);
+		dcache_clean_inval_range(buf, size);
+
+		spin_lock(&tsk->mm.lock);
+		if (order && map_stage2_block(tsk, base, TO_PADDR(buf),
+					      MMU_STAGE2_BLOCK_FLAGS) < 0) {
+			spin_unlock(&tsk->mm.lock);
+			deallocate_pages(buf, order);
+			/* read the chunk again, into pages */
+			r = f_lseek(&f, f_tell(&f) - br);
+			if (r)
+				break;
+			pages_until = base + size;
+			continue;
+		}
+		if (!order)
+			map_stage2_page(tsk, base, TO_PADDR(buf),
+					MMU_STAGE2_PAGE_FLAGS);
+		spin_unlock(&tsk->mm.lock);
+		gva = base + size;
 	}
 
 	f_close(&f);
+	spin_unlock(&fs_lock);
+	icache_inval_all();
 	INFO("file: %s loaded", name);
 
 	return -r;
 }
 
+/* frees its args, which create_raw_binary_task() allocated */
 int raw_binary_loader(void *arg, struct pt_regs *regs)
 {
 	struct raw_binary_loader_args *loader_args = arg;
+	int ret = -1;
+
+	current->mm.ram_size = loader_args->mem_size;
 
 	if (load_file_to_memory(current, loader_args->filename,
 				loader_args->load_addr) < 0)
-		return -1;
+		goto out;
+
+	if (loader_args->prefault && populate_task_ram(current) < 0)
+		goto out;
 	(void)strncpy(current->name, loader_args->filename, 36);
 
 	regs->pc = loader_args->entry_point;
@@ -62,6 +121,27 @@ int raw_binary_loader(void *arg, struct pt_regs *regs)
 	regs->regs[0] = 0;
 	regs->regs[1] = 0;
 	regs->regs[2] = 0;
+	ret = 0;
+
+out:
+	kfree(loader_args);
+	return ret;
+}
+
+/*
+ * Start a VM that loads a raw binary. The VM gets its own copy of args,
+ * since its loader runs later and maybe on another cpu.
+ */
+int create_raw_binary_task(const struct raw_binary_loader_args *args)
+{
+	struct raw_binary_loader_args *copy =
+		kmalloc(sizeof(*copy), ALLOC_NOZERO);
+	int pid;
+
+	memcpy(copy, args, sizeof(*copy));
+	pid = create_task(raw_binary_loader, copy);
+	if (pid < 0)
+		kfree(copy);
 
-	return 0;
+	return pid;
 }
@@ -19,6 +19,7 @@
 #include "common/sched.h"
 #include "common/sd.h"
 #include "common/shell.h"
+#include "common/smp.h"
 #include "common/task.h"
 #include "common/timer.h"
 #include "common/utils.h"
@@ -29,6 +30,8 @@ FATFS fatfs;
 
 void hypervisor_main()
 {
+	mm_init();
+	sched_init();
 	uart_init();
 	shell_init();
 	printf("=== aVisor Hypervisor ===\n");
@@ -39,6 +42,8 @@ void hypervisor_main()
 	timer_init();
 	disable_irq();
 	enable_interrupt_controller();
+	enable_ipi();
+	smp_init();
 
 	f_mount(&fatfs, "/", 0);
 
@@ -49,7 +54,7 @@ void hypervisor_main()
 		.filename = "lrtos.bin",
 	};
 
-	if (create_task(raw_binary_loader, &bl_args1) < 0) {
+	if (create_raw_binary_task(&bl_args1) < 0) {
 		printf("error while starting task\n");
 		return;
 	}
@@ -61,7 +66,7 @@ void hypervisor_main()
 		.filename = "echo.bin",
 	};
 
-	if (create_task(raw_binary_loader, &bl_args2) < 0) {
+	if (create_raw_binary_task(&bl_args2) < 0) {
 		printf("error while starting task\n");
 		return;
 	}
@@ -73,7 +78,7 @@ void hypervisor_main()
 		.filename = "uboot.bin",
 	};
 
-	if (create_task(raw_binary_loader, &bl_args3) < 0) {
+	if (create_raw_binary_task(&bl_args3) < 0) {
 		printf("error while starting task\n");
 		return;
 	}
@@ -85,14 +90,22 @@ void hypervisor_main()
 		.filename = "freertos.bin",
 	};
 
-	if (create_task(raw_binary_loader, &bl_args4) < 0) {
+	if (create_raw_binary_task(&bl_args4) < 0) {
 		printf("error while starting task\n");
 		return;
 	}
 
-	while (1) {
-		disable_irq();
-		schedule();
-		enable_irq();
-	}
+	cpu_idle();
+}
+
+void secondary_main()
+{
+	sched_init_cpu();
+	irq_vector_init();
+	disable_irq();
+	enable_ipi();
+	local_timer_init();
+	set_cpu_online(smp_processor_id());
+
+	cpu_idle();
 }
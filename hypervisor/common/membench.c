@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "common/membench.h"
+#include "arch/aarch64/timer.h"
+#include "common/mm.h"
+#include "common/printf.h"
+#include "common/utils.h"
+
+#define BENCH_ORDER 9 // 2 MiB buffers
+#define BENCH_BYTES (1 << 20) // moved per size class and kernel
+#define BENCH_MOVE_OFFSET 8 // memmove dst - src, forces the backward copy
+
+enum { BENCH_MEMCPY, BENCH_MEMMOVE, BENCH_MEMSET, BENCH_MEMZERO, NR_BENCH };
+
+static const char *bench_name[NR_BENCH] = {
+	"memcpy", "memmove", "memset", "memzero",
+};
+
+static const unsigned long bench_size[] = {
+	16, 64, 256, 1024, 4096, 65536, 1 << 20,
+};
+
+static uint64_t bench_run(int kernel, uint8_t *dst, uint8_t *src,
+			  unsigned long size)
+{
+	unsigned long i, loops = MAX(BENCH_BYTES / size, 1UL);
+	uint64_t start;
+
+	start = rdtsc0();
+	for (i = 0; i < loops; i++) {
+		switch (kernel) {
+		case BENCH_MEMCPY:
+			memcpy(dst, src, size);
+			break;
+		case BENCH_MEMMOVE:
+			memmove(src + BENCH_MOVE_OFFSET, src, size);
+			break;
+		case BENCH_MEMSET:
+			memset(dst, 0xa5, size);
+			break;
+		case BENCH_MEMZERO:
+			memzero(dst, size);
+			break;
+		}
+	}
+
+	return rdtsc0() - start;
+}
+
+/*
+ * Print bytes per cycle of each string kernel over page-aligned buffers,
+ * counted with the PMU cycle counter.
+ */
+void mem_bench(void)
+{
+	uint8_t *src, *dst;
+	unsigned long size, loops, bpc;
+	uint64_t cycles;
+	int i, k;
+
+	src = allocate_pages(BENCH_ORDER, ALLOC_NOZERO);
+	dst = allocate_pages(BENCH_ORDER, ALLOC_NOZERO);
+	if (!src || !dst) {
+		printf("Error: no %d KiB of contiguous memory!\n",
+		       (PAGE_SIZE << BENCH_ORDER) / 1024);
+		goto out;
+	}
+
+	enable_pmu_pmccntr();
+
+	printf("bytes/cycle, dc zva block: %lu bytes\n", zva_size);
+	printf("%8s", "size");
+	for (k = 0; k < NR_BENCH; k++)
+		printf(" %8s", bench_name[k]);
+	printf("\n");
+
+	for (i = 0; i < sizeof(bench_size) / sizeof(bench_size[0]); i++) {
+		size = bench_size[i];
+		loops = MAX(BENCH_BYTES / size, 1UL);
+		printf("%8lu", size);
+		for (k = 0; k < NR_BENCH; k++) {
+			bench_run(k, dst, src, size); // warm up
+			cycles = bench_run(k, dst, src, size);
+			bpc = size * loops * 100 / MAX(cycles, 1UL);
+			printf("    %2lu.%02lu", bpc / 100, bpc % 100);
+		}
+		printf("\n");
+	}
+
+out:
+	if (src)
+		deallocate_pages(src, BENCH_ORDER);
+	if (dst)
+		deallocate_pages(dst, BENCH_ORDER);
+}
@@ -9,18 +9,46 @@
 
 #include "common/mm.h"
 #include "arch/aarch64/mmu.h"
+#include "arch/aarch64/vmid.h"
 #include "boards/raspi/raspi3b.h"
 #include "common/board.h"
 #include "common/debug.h"
+#include "common/ksm.h"
+#include "common/printf.h"
 #include "common/task.h"
 #include "common/utils.h"
 
-paddr_t get_free_page(struct page_pool *pool);
-void free_page(struct page_pool *pool, paddr_t p);
+#define PAGE_BUDDY 0x80 // memap: the page heads a free block
+
+/* mapped read-only wherever a VM reads RAM it has never written */
+paddr_t empty_zero_page;
+
+paddr_t get_free_pages(struct page_pool *pool, int order, unsigned int flags);
+void free_pages(struct page_pool *pool, paddr_t p, int order);
+
+static inline paddr_t get_free_page(struct page_pool *pool)
+{
+	return get_free_pages(pool, 0, 0);
+}
+
+static inline void free_page(struct page_pool *pool, paddr_t p)
+{
+	free_pages(pool, p, 0);
+}
 
 void *allocate_page()
 {
-	paddr_t page = get_free_page(get_rasp3b_page_pool());
+	return allocate_pages(0, 0);
+}
+
+void deallocate_page(void *page)
+{
+	deallocate_pages(page, 0);
+}
+
+void *allocate_pages(int order, unsigned int flags)
+{
+	paddr_t page = get_free_pages(get_rasp3b_page_pool(), order, flags);
 
 	if (page == 0) {
 		return 0;
@@ -29,9 +57,9 @@ void *allocate_page()
 	return (void *)TO_VADDR(page);
 }
 
-void deallocate_page(void *page)
+void deallocate_pages(void *page, int order)
 {
-	free_page(get_rasp3b_page_pool(), TO_PADDR(page));
+	free_pages(get_rasp3b_page_pool(), TO_PADDR(page), order);
 }
 
 void *allocate_task_page(struct task_struct *task, vaddr_t va)
@@ -51,30 +79,258 @@ void set_task_page_notaccessable(struct task_struct *task, vaddr_t va)
 	map_stage2_page(task, va, 0, MMU_STAGE2_MMIO_PAGE_FLAGS);
 }
 
-paddr_t get_free_page(struct page_pool *pool)
+static inline struct list_head *page_list(struct page_pool *pool, uint64_t idx)
+{
+	return (struct list_head *)TO_VADDR(pool->start_addr + idx * PAGE_SIZE);
+}
+
+static inline uint64_t list_page(struct page_pool *pool, struct list_head *l)
+{
+	return (TO_PADDR(l) - pool->start_addr) / PAGE_SIZE;
+}
+
+static void add_free_block(struct page_pool *pool, uint64_t idx, int order)
+{
+	pool->memap[idx] = PAGE_BUDDY | order;
+	list_add(page_list(pool, idx), &pool->free_area[order].free_list);
+	pool->free_area[order].nr_free++;
+	pool->nr_free += 1UL << order;
+}
+
+static void del_free_block(struct page_pool *pool, uint64_t idx, int order)
+{
+	pool->memap[idx] = 0;
+	list_del(page_list(pool, idx));
+	pool->free_area[order].nr_free--;
+	pool->nr_free -= 1UL << order;
+}
+
+static void init_page_pool(struct page_pool *pool)
+{
+	uint64_t idx = 0;
+	int order;
+
+	spin_lock_init(&pool->lock);
+	for (order = 0; order < MAX_ORDER; order++) {
+		INIT_LIST_HEAD(&pool->free_area[order].free_list);
+		pool->free_area[order].nr_free = 0;
+	}
+	INIT_LIST_HEAD(&pool->zeroed);
+	pool->nr_zeroed = 0;
+	pool->nr_free = 0;
+	pool->nr_reserved = 0;
+
+	/* carve the pool into the largest naturally aligned blocks */
+	while (idx < pool->page_nr) {
+		order = MAX_ORDER - 1;
+		while ((idx & ((1UL << order) - 1)) ||
+		       idx + (1UL << order) > pool->page_nr)
+			order--;
+		add_free_block(pool, idx, order);
+		idx += 1UL << order;
+	}
+}
+
+void mm_init(void)
+{
+	init_dc_zva();
+	init_page_pool(get_rasp3b_page_pool());
+	empty_zero_page = get_free_page(get_rasp3b_page_pool());
+	ksm_init();
+}
+
+/*
+ * Take the first block of the smallest order that fits and split it,
+ * handing the upper halves back to the lower orders. Called with the pool
+ * locked, returns the page index or -1.
+ */
+static int64_t rmqueue(struct page_pool *pool, int order)
+{
+	struct free_area *area;
+	uint64_t idx;
+	int o;
+
+	for (o = order; o < MAX_ORDER; o++) {
+		area = &pool->free_area[o];
+		if (list_empty(&area->free_list))
+			continue;
+
+		idx = list_page(pool, area->free_list.next);
+		del_free_block(pool, idx, o);
+		while (o > order) {
+			o--;
+			add_free_block(pool, idx + (1UL << o), o);
+		}
+		return idx;
+	}
+
+	return -1;
+}
+
+/*
+ * Merge the block with its buddy for as long as the buddy is free and of
+ * the same order. Called with the pool locked.
+ */
+static void __free_pages(struct page_pool *pool, uint64_t idx, int order)
+{
+	uint64_t buddy;
+
+	while (order < MAX_ORDER - 1) {
+		buddy = idx ^ (1UL << order);
+		if (buddy >= pool->page_nr ||
+		    pool->memap[buddy] != (PAGE_BUDDY | order))
+			break;
+		del_free_block(pool, buddy, order);
+		idx &= ~(1UL << order);
+		order++;
+	}
+	add_free_block(pool, idx, order);
+}
+
+/* Called with the pool locked, returns the page or 0 if there is none. */
+static paddr_t take_zeroed_page(struct page_pool *pool)
+{
+	struct list_head *l;
+
+	if (list_empty(&pool->zeroed))
+		return 0;
+
+	l = pool->zeroed.next;
+	list_del(l);
+	pool->nr_zeroed--;
+	l->next = 0;
+	l->prev = 0;
+	dcache_clean_inval_range(l, sizeof(*l));
+	return TO_PADDR(l);
+}
+
+/* Give the zeroed pages back to the buddy lists so they can merge. */
+static void drain_zeroed_pages(struct page_pool *pool)
+{
+	paddr_t page;
+
+	while ((page = take_zeroed_page(pool)))
+		__free_pages(pool, (page - pool->start_addr) / PAGE_SIZE, 0);
+}
+
+/*
+ * Single pages are served from the zeroed list first, so the fault path
+ * does not pay for memzero() unless the idle cpus fell behind. Zeroed pages
+ * are clean to the point of coherency, a VM may read them with its caches
+ * off.
+ */
+paddr_t get_free_pages(struct page_pool *pool, int order, unsigned int flags)
 {
-	uint64_t i, index;
 	paddr_t page;
+	int64_t idx;
+
+	if (order < 0 || order >= MAX_ORDER)
+		return 0;
+
+	spin_lock(&pool->lock);
 
-	for (i = pool->last_page_id; i < (pool->last_page_id + pool->page_nr);
-	     i++) {
-		index = i % pool->page_nr;
-		if (pool->memap[index] == 0) {
-			pool->memap[index] = 1;
-			page = pool->start_addr + index * PAGE_SIZE;
-			memzero((void *)TO_VADDR(page), PAGE_SIZE);
-			pool->last_page_id = index;
+	if (order == 0 && !(flags & ALLOC_NOZERO)) {
+		page = take_zeroed_page(pool);
+		if (page) {
+			spin_unlock(&pool->lock);
 			return page;
 		}
 	}
 
-	PANIC("no free pages!\n");
-	return 0;
+	idx = rmqueue(pool, order);
+	if (idx < 0 && pool->nr_zeroed) {
+		drain_zeroed_pages(pool);
+		idx = rmqueue(pool, order);
+	}
+
+	spin_unlock(&pool->lock);
+
+	if (idx < 0) {
+		if (order == 0 && !(flags & ALLOC_TRY))
+			PANIC("no free pages!\n");
+		return 0;
+	}
+
+	page = pool->start_addr + idx * PAGE_SIZE;
+	if (!(flags & ALLOC_NOZERO)) {
+		memzero((void *)TO_VADDR(page), PAGE_SIZE << order);
+		dcache_clean_inval_range((void *)TO_VADDR(page),
+					 PAGE_SIZE << order);
+	}
+	return page;
+}
+
+void free_pages(struct page_pool *pool, paddr_t p, int order)
+{
+	uint64_t idx = (p - pool->start_addr) / PAGE_SIZE;
+
+	spin_lock(&pool->lock);
+
+	if (pool->memap[idx] & PAGE_BUDDY) {
+		spin_unlock(&pool->lock);
+		WARN("page 0x%lx is already free", p);
+		return;
+	}
+
+	__free_pages(pool, idx, order);
+
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Zero one free page into the zeroed list. Called by idle cpus, returns 0
+ * once the list is full or memory is short.
+ */
+int zero_free_page(void)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
+	struct list_head *l;
+	int64_t idx;
+
+	spin_lock(&pool->lock);
+	if (pool->nr_zeroed >= ZEROED_PAGES ||
+	    pool->free_area[MAX_ORDER - 1].nr_free == 0) {
+		spin_unlock(&pool->lock);
+		return 0;
+	}
+	idx = rmqueue(pool, 0);
+	spin_unlock(&pool->lock);
+
+	if (idx < 0)
+		return 0;
+
+	l = page_list(pool, idx);
+	memzero(l, PAGE_SIZE);
+	dcache_clean_inval_range(l, PAGE_SIZE);
+
+	spin_lock(&pool->lock);
+	list_add(l, &pool->zeroed);
+	pool->nr_zeroed++;
+	spin_unlock(&pool->lock);
+
+	return 1;
 }
 
-void free_page(struct page_pool *pool, paddr_t p)
+void show_mem_stat(void)
 {
-	pool->memap[(p - pool->start_addr) / PAGE_SIZE] = 0;
+	struct page_pool *pool = get_rasp3b_page_pool();
+	uint64_t nr_free[MAX_ORDER], nr_zeroed, total = 0;
+	int order;
+
+	spin_lock(&pool->lock);
+	for (order = 0; order < MAX_ORDER; order++)
+		nr_free[order] = pool->free_area[order].nr_free;
+	nr_zeroed = pool->nr_zeroed;
+	spin_unlock(&pool->lock);
+
+	printf("%5s %8s %8s\n", "order", "blocks", "pages");
+	for (order = 0; order < MAX_ORDER; order++) {
+		printf("%5d %8lu %8lu\n", order, nr_free[order],
+		       nr_free[order] << order);
+		total += nr_free[order] << order;
+	}
+	printf("zeroed: %lu pages\n", nr_zeroed);
+	printf("free: %lu of %lu pages\n", total + nr_zeroed, pool->page_nr);
 }
 
 void map_stage2_table_entry(vaddr_t pte, vaddr_t va, paddr_t pa, uint64_t flags)
@@ -87,8 +343,21 @@ void map_stage2_table_entry(vaddr_t pte, vaddr_t va, paddr_t pa, uint64_t flags)
 	((uint64_t *)pte)[index] = entry;
 }
 
-static paddr_t map_stage2_table(vaddr_t table, uint64_t shift, vaddr_t va,
-			 int *new_table)
+/*
+ * A page for a stage-2 table of the VM, taken from the ones a fault set
+ * aside with prepare_stage2_tables() if there are any. Can only return 0
+ * with ALLOC_TRY in flags.
+ */
+static paddr_t alloc_table_page(struct task_struct *task, unsigned int flags)
+{
+	if (task->mm.nr_table_cache)
+		return task->mm.table_cache[--task->mm.nr_table_cache];
+
+	return get_free_pages(get_rasp3b_page_pool(), 0, flags);
+}
+
+static paddr_t map_stage2_table(struct task_struct *task, vaddr_t table,
+				uint64_t shift, vaddr_t va, int *new_table)
 {
 	uint64_t index = va >> shift;
 
@@ -96,8 +365,7 @@ static paddr_t map_stage2_table(vaddr_t table, uint64_t shift, vaddr_t va,
 
 	if (!((uint64_t *)table)[index]) {
 		*new_table = 1;
-		paddr_t next_level_table =
-			get_free_page(get_rasp3b_page_pool());
+		paddr_t next_level_table = alloc_table_page(task, 0);
 		uint64_t entry = next_level_table | MM_TYPE_PAGE_TABLE;
 
 		((uint64_t *)table)[index] = entry;
@@ -109,63 +377,953 @@ static paddr_t map_stage2_table(vaddr_t table, uint64_t shift, vaddr_t va,
 	return ((uint64_t *)table)[index] & PAGE_MASK;
 }
 
-bool check_task_page_mapped(struct task_struct *task, vaddr_t va)
+/* Returns the level 2 entry that covers va, allocating the tables above it. */
+static uint64_t *stage2_pmd(struct task_struct *task, vaddr_t va,
+			    int *new_table)
 {
-	paddr_t lv1_table;
+	paddr_t lv2_table;
 
 	if (!task->mm.first_table) {
-		task->mm.first_table = get_free_page(get_rasp3b_page_pool());
+		task->mm.first_table = alloc_table_page(task, 0);
+		task->mm.kernel_pages_count++;
+	}
+
+	lv2_table = map_stage2_table(task, TO_VADDR(task->mm.first_table),
+				     LV1_SHIFT, va, new_table);
+	if (*new_table)
 		task->mm.kernel_pages_count++;
+
+	return (uint64_t *)TO_VADDR(lv2_table) +
+	       ((va >> (LV2_SHIFT)) & (PTRS_PER_TABLE - 1));
+}
+
+static inline bool is_stage2_block(uint64_t entry)
+{
+	return (entry & MM_DESC_TYPE_MASK) == MM_TYPE_BLOCK;
+}
+
+/* guest RAM, as opposed to MMIO entries that map nothing */
+static inline bool is_stage2_ram(uint64_t entry)
+{
+	return (entry & MM_STAGE2_AP) != MM_STAGE2_AP_NONE;
+}
+
+/* guest RAM that only this mapping uses */
+static inline bool is_stage2_private(uint64_t entry)
+{
+	return (entry & MM_STAGE2_AP) == MM_STAGE2_AP;
+}
+
+/* The level 3 entry for va, pmd must point to a table. */
+static inline uint64_t *stage2_pte(uint64_t *pmd, vaddr_t va)
+{
+	return (uint64_t *)TO_VADDR((*pmd & MM_DESC_ADDR_MASK)) +
+	       ((va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1));
+}
+
+/*
+ * The level 2 entry that covers va, or NULL if there is no level 2 table
+ * for it. Unlike stage2_pmd() this never allocates.
+ */
+static uint64_t *stage2_find_pmd(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pgd, entry;
+
+	if (!task->mm.first_table)
+		return NULL;
+
+	pgd = (uint64_t *)TO_VADDR(task->mm.first_table);
+	entry = pgd[(va >> (LV1_SHIFT)) & (PTRS_PER_TABLE - 1)];
+	if (!entry)
+		return NULL;
+
+	return (uint64_t *)TO_VADDR((entry & MM_DESC_ADDR_MASK)) +
+	       ((va >> (LV2_SHIFT)) & (PTRS_PER_TABLE - 1));
+}
+
+/*
+ * Replace a block with a level 3 table that maps the same memory page by
+ * page, break-before-make. Returns -1, leaving the block alone, if there
+ * is no page for the table and flags has ALLOC_TRY.
+ */
+static int split_stage2_block(struct task_struct *task, uint64_t *pmd,
+			      vaddr_t va, unsigned int flags)
+{
+	uint64_t block = *pmd;
+	uint64_t attrs = (block & MM_DESC_ATTR_MASK) | MM_TYPE_PAGE;
+	paddr_t pa = block & MM_DESC_ADDR_MASK;
+	paddr_t table = alloc_table_page(task, flags);
+	uint64_t *pte = (uint64_t *)TO_VADDR(table);
+	int i;
+
+	if (!table)
+		return -1;
+
+	for (i = 0; i < PTRS_PER_TABLE; i++)
+		pte[i] = (pa + i * PAGE_SIZE) | attrs;
+
+	*pmd = 0;
+	flush_task_ipa_tlb(task, va & SECTION_MASK);
+	*pmd = table | MM_TYPE_PAGE_TABLE;
+	task->mm.kernel_pages_count++;
+	return 0;
+}
+
+bool check_task_page_mapped(struct task_struct *task, vaddr_t va)
+{
+	int new_table;
+	uint64_t *pmd;
+	bool mapped = false;
+
+	spin_lock(&task->mm.lock);
+
+	pmd = stage2_pmd(task, va, &new_table);
+	if (new_table)
+		goto out;
+
+	if (is_stage2_block(*pmd)) {
+		mapped = true;
+		goto out;
 	}
 
-	lv1_table = task->mm.first_table;
+	map_stage2_table(task, (vaddr_t)pmd & PAGE_MASK, LV2_SHIFT, va,
+			 &new_table);
+
+	if (new_table)
+		task->mm.kernel_pages_count++;
+	else
+		mapped = true;
+
+out:
+	spin_unlock(&task->mm.lock);
+	return mapped;
+}
+
+void map_stage2_page(struct task_struct *task, vaddr_t va, paddr_t page,
+		     uint64_t flags)
+{
 	int new_table;
-	paddr_t lv2_table = map_stage2_table(TO_VADDR(lv1_table), LV1_SHIFT, va,
-					     &new_table);
+	uint64_t *pmd = stage2_pmd(task, va, &new_table), *pte;
+
+	if (is_stage2_block(*pmd))
+		split_stage2_block(task, pmd, va, 0);
+
+	paddr_t lv3_table = map_stage2_table(task, (vaddr_t)pmd & PAGE_MASK,
+					     LV2_SHIFT, va, &new_table);
 
 	if (new_table) {
 		task->mm.kernel_pages_count++;
+	}
+
+	pte = (uint64_t *)TO_VADDR(lv3_table) +
+	      ((va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1));
+	if (*pte) {
+		// break-before-make, the old entry may be in a TLB
+		*pte = 0;
+		flush_task_ipa_tlb(task, va & PAGE_MASK);
+	} else if (is_stage2_ram(flags) && page != empty_zero_page) {
+		// a replaced page, or one of a split block, is counted already
+		task->mm.user_pages_count++;
+	}
+
+	map_stage2_table_entry(TO_VADDR(lv3_table), va, page, flags);
+}
+
+/*
+ * Map a 2 MiB block at a 2 MiB aligned va. Fails if anything is mapped
+ * there already.
+ */
+int map_stage2_block(struct task_struct *task, vaddr_t va, paddr_t block,
+		     uint64_t flags)
+{
+	int new_table;
+	uint64_t *pmd = stage2_pmd(task, va, &new_table);
+
+	if (*pmd)
+		return -1;
+
+	*pmd = block | flags;
+	if (is_stage2_ram(flags))
+		task->mm.user_pages_count += PTRS_PER_TABLE;
+	return 0;
+}
+
+/*
+ * The helpers below serve same-page merging and are called with the VM's
+ * mm lock held.
+ */
+
+/*
+ * The page of private RAM that backs va, or 0 if there is none. *next is
+ * set to the next va worth looking at, so that unmapped 2 MiB are skipped
+ * in one go.
+ */
+paddr_t stage2_private_page(struct task_struct *task, vaddr_t va,
+			    vaddr_t *next)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+	uint64_t *pte;
+
+	*next = (va & PAGE_MASK) + PAGE_SIZE;
+
+	if (!pmd || !*pmd) {
+		*next = (va & SECTION_MASK) + SECTION_SIZE;
+		return 0;
+	}
+
+	if (is_stage2_block(*pmd)) {
+		if (!is_stage2_ram(*pmd)) {
+			*next = (va & SECTION_MASK) + SECTION_SIZE;
+			return 0;
+		}
+		if (!is_stage2_private(*pmd))
+			return 0;
+		return (*pmd & MM_DESC_ADDR_MASK) + (va & ~SECTION_MASK & PAGE_MASK);
+	}
+
+	pte = stage2_pte(pmd, va);
+	if (!*pte || !is_stage2_private(*pte))
+		return 0;
+
+	return *pte & MM_DESC_ADDR_MASK;
+}
+
+/* The read-only page of RAM that backs va, or 0 if there is none. */
+paddr_t stage2_readonly_page(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+	uint64_t *pte;
+
+	if (!pmd || !*pmd || is_stage2_block(*pmd))
+		return 0;
+
+	pte = stage2_pte(pmd, va);
+	if ((*pte & MM_STAGE2_AP) != MM_STAGE2_AP_RO)
+		return 0;
+
+	return *pte & MM_DESC_ADDR_MASK;
+}
+
+/*
+ * Make the private page at va read-only, splitting its block if it is in
+ * one, so that its contents hold still while they are compared. Returns
+ * the page, or 0 if va is not backed by private RAM or its block cannot be
+ * split for lack of a table page.
+ */
+paddr_t stage2_wrprotect_page(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+	uint64_t *pte;
+
+	if (!pmd || !*pmd || !is_stage2_ram(*pmd))
+		return 0;
+
+	if (is_stage2_block(*pmd)) {
+		if (!is_stage2_private(*pmd) ||
+		    split_stage2_block(task, pmd, va, ALLOC_TRY) < 0)
+			return 0;
+	}
+
+	pte = stage2_pte(pmd, va);
+	if (!*pte || !is_stage2_private(*pte))
+		return 0;
+
+	*pte = (*pte & ~MM_STAGE2_AP) | MM_STAGE2_AP_RO;
+	flush_task_ipa_tlb(task, va & PAGE_MASK);
+
+	/* the VM may have written it with its caches off */
+	dcache_clean_inval_range((void *)TO_VADDR((*pte & MM_DESC_ADDR_MASK)),
+				 PAGE_SIZE);
+	return *pte & MM_DESC_ADDR_MASK;
+}
+
+/*
+ * Split the read-only block that a clone shares at va, so that its pages
+ * can be unshared one by one. Returns -1 if there is no page for the table.
+ */
+int stage2_split_shared_block(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+
+	if (!pmd || !is_stage2_block(*pmd) || !is_stage2_ram(*pmd) ||
+	    is_stage2_private(*pmd))
+		return 0;
+
+	return split_stage2_block(task, pmd, va, ALLOC_TRY);
+}
+
+/*
+ * Give write access back to a read-only page. Permissions only grow, so
+ * a stale TLB entry costs at most one spurious fault.
+ */
+void stage2_make_writable(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+	uint64_t *pte;
+
+	if (!pmd || !*pmd || is_stage2_block(*pmd))
+		return;
+
+	pte = stage2_pte(pmd, va);
+	if (*pte && is_stage2_ram(*pte))
+		*pte |= MM_STAGE2_AP;
+}
+
+/* Point the mapped page at va to another page, break-before-make. */
+void stage2_replace_page(struct task_struct *task, vaddr_t va, paddr_t page,
+			 uint64_t flags)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+	uint64_t *pte;
+
+	if (!pmd || !*pmd || is_stage2_block(*pmd))
+		return;
+
+	pte = stage2_pte(pmd, va);
+	*pte = 0;
+	flush_task_ipa_tlb(task, va & PAGE_MASK);
+	*pte = page | flags;
+}
+
+/* Whether va is guest RAM, which never turns into MMIO or back. */
+bool stage2_is_ram(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd = stage2_find_pmd(task, va);
+
+	if (!pmd || !*pmd)
 		return false;
+
+	if (is_stage2_block(*pmd))
+		return is_stage2_ram(*pmd);
+
+	return is_stage2_ram(*stage2_pte(pmd, va));
+}
+
+/*
+ * Pages of the pool that VMs other than except have reserved and do not
+ * use yet. task_lock keeps the VMs from being released under the walk.
+ */
+static unsigned long unused_reservations(struct task_struct *except)
+{
+	struct task_struct *p;
+	unsigned long used, sum = 0;
+	int i;
+
+	spin_lock(&task_lock);
+	for (i = 0; i < nr_tasks; i++) {
+		p = task[i];
+		if (!p || p == except || !p->mm.reserved_pages)
+			continue;
+		used = p->mm.user_pages_count + p->mm.kernel_pages_count;
+		if (used < p->mm.reserved_pages)
+			sum += p->mm.reserved_pages - used;
 	}
+	spin_unlock(&task_lock);
 
-	map_stage2_table(TO_VADDR(lv2_table), LV2_SHIFT, va, &new_table);
+	return sum;
+}
 
-	if (new_table) {
-		task->mm.kernel_pages_count++;
+/*
+ * Whether the VM may take pages more pages of RAM and tables more table
+ * pages: within its limits, and without eating into what the pool holds
+ * back for other VMs.
+ */
+bool may_alloc_task_pages(struct task_struct *task, unsigned long pages,
+			  unsigned long tables)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
+	struct mm_struct *mm = &task->mm;
+
+	if (mm->max_pages && mm->user_pages_count + pages > mm->max_pages)
+		return false;
+
+	if (mm->max_table_pages &&
+	    mm->kernel_pages_count + tables > mm->max_table_pages)
 		return false;
+
+	if (!pool->nr_reserved)
+		return true;
+
+	return pool->nr_free + pool->nr_zeroed >=
+	       unused_reservations(task) + pages + tables;
+}
+
+void set_task_limits(struct task_struct *task, unsigned long max_pages,
+		     unsigned long max_table_pages, int oom_policy)
+{
+	task->mm.max_pages = max_pages;
+	task->mm.max_table_pages = max_table_pages;
+	task->mm.oom_policy = oom_policy;
+}
+
+/*
+ * Hold pages of the pool back for the VM: no other VM faults them in while
+ * the VM uses fewer pages than it reserved. Fails if the free pages do not
+ * cover the reservations.
+ */
+int set_task_reservation(struct task_struct *task, unsigned long pages)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
+	unsigned long used =
+		task->mm.user_pages_count + task->mm.kernel_pages_count;
+
+	spin_lock(&pool->lock);
+	if (pages > used && pool->nr_free + pool->nr_zeroed <
+				    unused_reservations(task) + pages - used) {
+		spin_unlock(&pool->lock);
+		return -1;
 	}
+	pool->nr_reserved += pages - task->mm.reserved_pages;
+	task->mm.reserved_pages = pages;
+	spin_unlock(&pool->lock);
 
-	return true;
+	return 0;
 }
 
-void map_stage2_page(struct task_struct *task, vaddr_t va, paddr_t page,
-		     uint64_t flags)
+/* The table pages that mapping a page at va may have to allocate. */
+static int stage2_tables_needed(struct task_struct *task, vaddr_t va)
 {
-	paddr_t lv1_table;
+	uint64_t *pmd;
 
-	if (!task->mm.first_table) {
-		task->mm.first_table = get_free_page(get_rasp3b_page_pool());
-		task->mm.kernel_pages_count++;
+	if (!task->mm.first_table)
+		return STAGE2_LEVELS;
+
+	pmd = stage2_find_pmd(task, va);
+	if (!pmd)
+		return STAGE2_LEVELS - 1;
+
+	if (!*pmd || is_stage2_block(*pmd))
+		return 1; // a level 3 table, or the one a split needs
+
+	return 0;
+}
+
+/*
+ * Set the table pages that mapping va needs aside, so that the walk can not
+ * run out of pages halfway. Returns -1 if the VM may not have them.
+ */
+static int prepare_stage2_tables(struct task_struct *task, vaddr_t va)
+{
+	int needed = stage2_tables_needed(task, va);
+	paddr_t page;
+
+	if (needed <= task->mm.nr_table_cache)
+		return 0;
+
+	if (!may_alloc_task_pages(task, 0, needed))
+		return -1;
+
+	while (task->mm.nr_table_cache < needed) {
+		page = get_free_pages(get_rasp3b_page_pool(), 0, ALLOC_TRY);
+		if (!page)
+			return -1;
+		task->mm.table_cache[task->mm.nr_table_cache++] = page;
+	}
+
+	return 0;
+}
+
+/*
+ * The VM faulted on memory it may not have, being over its limits or the
+ * pool out of pages. The access is retried whenever the VM runs again.
+ */
+static int task_out_of_memory(struct task_struct *task, vaddr_t ipa)
+{
+	task->stat.oom_count++;
+
+	if (task->mm.oom_policy == MM_OOM_WAIT) {
+		schedule();
+		return 0;
 	}
 
-	lv1_table = task->mm.first_table;
+	WARN("VM %ld is out of memory at 0x%lx, killed", task->pid, ipa);
+	exit_task();
+	return 0;
+}
+
+/*
+ * Back the faulting page of guest RAM, with a whole block if nothing else
+ * is mapped in its 2 MiB, the block is inside the VM's RAM and the pool has
+ * one. Returns -1 if the VM may not have another page.
+ */
+static int map_stage2_ram(struct task_struct *task, vaddr_t va)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
 	int new_table;
-	paddr_t lv2_table = map_stage2_table(TO_VADDR(lv1_table), LV1_SHIFT, va,
-					     &new_table);
+	uint64_t *pmd;
+	paddr_t page;
 
-	if (new_table) {
-		task->mm.kernel_pages_count++;
+	if (prepare_stage2_tables(task, va) < 0)
+		return -1;
+
+	pmd = stage2_pmd(task, va, &new_table);
+	if (!*pmd &&
+	    (!task->mm.ram_size ||
+	     (va & SECTION_MASK) + SECTION_SIZE <= task->mm.ram_size) &&
+	    may_alloc_task_pages(task, PTRS_PER_TABLE, 0)) {
+		page = get_free_pages(pool, STAGE2_BLOCK_ORDER, 0);
+		if (page) {
+			map_stage2_block(task, va & SECTION_MASK, page,
+					 MMU_STAGE2_BLOCK_FLAGS);
+			return 0;
+		}
 	}
 
-	paddr_t lv3_table = map_stage2_table(TO_VADDR(lv2_table), LV2_SHIFT, va,
-					     &new_table);
+	if (!may_alloc_task_pages(task, 1, 0))
+		return -1;
 
-	if (new_table) {
+	page = get_free_pages(pool, 0, ALLOC_TRY);
+	if (page == 0)
+		return -1;
+
+	map_stage2_page(task, va & PAGE_MASK, page, MMU_STAGE2_PAGE_FLAGS);
+	return 0;
+}
+
+/*
+ * Back a page that is read before it is ever written with the shared zero
+ * page. The first write takes a permission fault and gets a page of its
+ * own from break_zero_page().
+ */
+static int map_stage2_zero(struct task_struct *task, vaddr_t va)
+{
+	int new_table;
+	uint64_t *pmd;
+	paddr_t lv3_table;
+
+	if (prepare_stage2_tables(task, va) < 0)
+		return -1;
+
+	pmd = stage2_pmd(task, va, &new_table);
+	if (is_stage2_block(*pmd))
+		return 0;
+
+	lv3_table = map_stage2_table(task, (vaddr_t)pmd & PAGE_MASK, LV2_SHIFT,
+				     va, &new_table);
+	if (new_table)
 		task->mm.kernel_pages_count++;
-	}
 
-	map_stage2_table_entry(TO_VADDR(lv3_table), va, page, flags);
+	map_stage2_table_entry(TO_VADDR(lv3_table), va, empty_zero_page,
+			       MMU_STAGE2_RO_PAGE_FLAGS);
+	return 0;
+}
+
+/*
+ * Give the VM a page of its own where it wrote to the zero page. Returns 0
+ * if va is not mapped to the zero page, -1 if the VM may not have a page.
+ */
+static int break_zero_page(struct task_struct *task, vaddr_t va)
+{
+	paddr_t page;
+	int ret = 0;
+
+	spin_lock(&task->mm.lock);
+	if (stage2_readonly_page(task, va) != empty_zero_page)
+		goto out;
+
+	ret = -1;
+	if (!may_alloc_task_pages(task, 1, 0))
+		goto out;
+	page = get_free_pages(get_rasp3b_page_pool(), 0, ALLOC_TRY);
+	if (!page)
+		goto out;
+
+	stage2_replace_page(task, va & PAGE_MASK, page, MMU_STAGE2_PAGE_FLAGS);
 	task->mm.user_pages_count++;
+	task->stat.pf_count++;
+	ret = 1;
+
+out:
+	spin_unlock(&task->mm.lock);
+	return ret;
+}
+
+/*
+ * Make the RAM page at va writable for the VM, copying it if need be.
+ * Returns -1 if the VM may not have the copy.
+ */
+int unshare_task_page(struct task_struct *task, vaddr_t va)
+{
+	int ret = break_zero_page(task, va);
+
+	if (ret == 0)
+		ret = ksm_break_cow(task, va);
+
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * After a fault was served with a page, also map the free slots of the
+ * aligned fault_around window around it, so that sequential accesses do
+ * not exit once per page. After a read fault the slots get the zero page.
+ */
+static void map_fault_around(struct task_struct *task, vaddr_t va, bool read)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
+	unsigned long window = task->mm.fault_around * PAGE_SIZE;
+	vaddr_t addr, end;
+	uint64_t *pmd, *pte;
+	int new_table;
+	paddr_t page;
+
+	if (task->mm.fault_around <= 1)
+		return;
+
+	pmd = stage2_pmd(task, va, &new_table);
+	if (is_stage2_block(*pmd) || !*pmd)
+		return;
+
+	addr = va & ~(window - 1);
+	end = addr + window;
+	if (task->mm.ram_size && end > task->mm.ram_size)
+		end = task->mm.ram_size;
+
+	for (; addr < end; addr += PAGE_SIZE) {
+		pte = stage2_pte(pmd, addr);
+		if (*pte)
+			continue;
+		if (read) {
+			*pte = empty_zero_page | MMU_STAGE2_RO_PAGE_FLAGS;
+			task->stat.fault_around_count++;
+			continue;
+		}
+		if (!may_alloc_task_pages(task, 1, 0))
+			return;
+		page = get_free_pages(pool, 0, ALLOC_TRY);
+		if (!page)
+			return;
+		*pte = page | MMU_STAGE2_PAGE_FLAGS;
+		task->mm.user_pages_count++;
+		task->stat.fault_around_count++;
+	}
+}
+
+int set_fault_around(struct task_struct *task, int pages)
+{
+	if (pages < 1 || pages > PTRS_PER_TABLE || (pages & (pages - 1)))
+		return -1;
+
+	task->mm.fault_around = pages;
+	return 0;
+}
+
+/*
+ * Map all of the VM's RAM that is not mapped yet, so that it takes no
+ * translation faults once it runs.
+ */
+int populate_task_ram(struct task_struct *task)
+{
+	vaddr_t va = 0;
+	uint64_t *pmd, *pte;
+	int new_table, ret = 0;
+
+	spin_lock(&task->mm.lock);
+	while (va < task->mm.ram_size) {
+		pmd = stage2_pmd(task, va, &new_table);
+		if (is_stage2_block(*pmd)) {
+			va = (va & SECTION_MASK) + SECTION_SIZE;
+			continue;
+		}
+		if (*pmd) {
+			pte = stage2_pte(pmd, va);
+			if (*pte) {
+				va += PAGE_SIZE;
+				continue;
+			}
+		}
+		if (map_stage2_ram(task, va) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	spin_unlock(&task->mm.lock);
+
+	return ret;
+}
+
+/*
+ * Free the VM's RAM and every stage-2 table page. The VM must not be able
+ * to run anymore. Its TLB entries need no flush, its VMID is not handed
+ * out again before a rollover flushes them. Merged pages only lose one
+ * reference.
+ */
+void free_task_mm(struct task_struct *task)
+{
+	struct page_pool *pool = get_rasp3b_page_pool();
+	uint64_t *pgd, *pmd, *pte;
+	paddr_t pa;
+	int i, j, k;
+
+	while (task->mm.nr_table_cache)
+		free_page(pool, task->mm.table_cache[--task->mm.nr_table_cache]);
+	set_task_reservation(task, 0);
+
+	if (!task->mm.first_table)
+		return;
+
+	pgd = (uint64_t *)TO_VADDR(task->mm.first_table);
+	for (i = 0; i < PTRS_PER_TABLE; i++) {
+		if (!pgd[i])
+			continue;
+
+		pmd = (uint64_t *)TO_VADDR((pgd[i] & MM_DESC_ADDR_MASK));
+		for (j = 0; j < PTRS_PER_TABLE; j++) {
+			if (!pmd[j])
+				continue;
+
+			if (is_stage2_block(pmd[j])) {
+				pa = pmd[j] & MM_DESC_ADDR_MASK;
+				if (!is_stage2_ram(pmd[j]))
+					continue;
+				if (is_stage2_private(pmd[j])) {
+					free_pages(pool, pa,
+						   STAGE2_BLOCK_ORDER);
+					continue;
+				}
+				// a block shared with a clone
+				for (k = 0; k < PTRS_PER_TABLE; k++)
+					ksm_put_page(pa + k * PAGE_SIZE);
+				continue;
+			}
+
+			pte = (uint64_t *)TO_VADDR((pmd[j] & MM_DESC_ADDR_MASK));
+			for (k = 0; k < PTRS_PER_TABLE; k++) {
+				if (!pte[k] || !is_stage2_ram(pte[k]) ||
+				    (pte[k] & MM_DESC_ADDR_MASK) ==
+					    empty_zero_page)
+					continue;
+				if (is_stage2_private(pte[k]))
+					free_page(pool,
+						  pte[k] & MM_DESC_ADDR_MASK);
+				else
+					ksm_put_page(pte[k] &
+						     MM_DESC_ADDR_MASK);
+			}
+			free_page(pool, pmd[j] & MM_DESC_ADDR_MASK);
+		}
+		free_page(pool, pgd[i] & MM_DESC_ADDR_MASK);
+	}
+	free_page(pool, task->mm.first_table);
+
+	task->mm.first_table = 0;
+	task->mm.user_pages_count = 0;
+	task->mm.kernel_pages_count = 0;
+}
+
+/*
+ * Map the page of src that entry maps at va into dst as well, sharing RAM
+ * read-only. A page that cannot be shared for lack of memory is copied.
+ * Returns -1 if dst may not have the copy or its tables.
+ */
+static int clone_stage2_page(struct task_struct *dst, vaddr_t va,
+			     uint64_t *entry)
+{
+	paddr_t pa = *entry & MM_DESC_ADDR_MASK;
+	paddr_t copy;
+
+	if (prepare_stage2_tables(dst, va) < 0)
+		return -1;
+
+	if (is_stage2_ram(*entry) && pa != empty_zero_page) {
+		if (__ksm_share_page(pa) < 0) {
+			if (!may_alloc_task_pages(dst, 1, 0))
+				return -1;
+			copy = get_free_pages(get_rasp3b_page_pool(), 0,
+					      ALLOC_NOZERO | ALLOC_TRY);
+			if (!copy)
+				return -1;
+			memcpy((void *)TO_VADDR(copy), (void *)TO_VADDR(pa),
+			       PAGE_SIZE);
+			dcache_clean_inval_range((void *)TO_VADDR(copy),
+						 PAGE_SIZE);
+			map_stage2_page(dst, va, copy, MMU_STAGE2_PAGE_FLAGS);
+			return 0;
+		}
+		*entry = (*entry & ~MM_STAGE2_AP) | MM_STAGE2_AP_RO;
+	}
+
+	map_stage2_page(dst, va, pa, *entry & ~MM_DESC_ADDR_MASK);
+	return 0;
+}
+
+/*
+ * Map the RAM block of src that *pmd maps at va into dst as well, both
+ * read-only. Its pages are shared one by one, so a write only splits the
+ * block of the VM that wrote and copies that one page. Returns 1, leaving
+ * the block alone, if not every page could be shared.
+ */
+static int clone_stage2_block(struct task_struct *dst, vaddr_t va,
+			      uint64_t *pmd)
+{
+	paddr_t pa = *pmd & MM_DESC_ADDR_MASK;
+	bool private = is_stage2_private(*pmd);
+	int k;
+
+	if (prepare_stage2_tables(dst, va) < 0)
+		return -1;
+
+	for (k = 0; k < PTRS_PER_TABLE; k++) {
+		if (__ksm_share_page(pa + k * PAGE_SIZE) < 0) {
+			while (k--)
+				__ksm_unshare_page(pa + k * PAGE_SIZE, private);
+			return 1;
+		}
+	}
+
+	*pmd = (*pmd & ~MM_STAGE2_AP) | MM_STAGE2_AP_RO;
+	map_stage2_block(dst, va, pa, *pmd & ~MM_DESC_ADDR_MASK);
+	return 0;
+}
+
+/*
+ * Take the RAM page at va away from the VM: free it, or drop the VM's
+ * reference if it is shared. Returns 1 if a page was taken, 0 if there
+ * was none (a zero page mapping only goes away), and -1 if va is not guest
+ * RAM or is in a block that cannot be split for lack of a table page.
+ */
+int unmap_task_page(struct task_struct *task, vaddr_t va)
+{
+	uint64_t *pmd, *pte, entry = 0;
+	paddr_t pa;
+	int ret = 0;
+
+	spin_lock(&task->mm.lock);
+
+	pmd = stage2_find_pmd(task, va);
+	if (!pmd || !*pmd)
+		goto out;
+
+	if (!is_stage2_ram(*pmd)) {
+		ret = -1;
+		goto out;
+	}
+
+	if (is_stage2_block(*pmd) &&
+	    split_stage2_block(task, pmd, va, ALLOC_TRY) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	pte = stage2_pte(pmd, va);
+	if (*pte && !is_stage2_ram(*pte)) {
+		ret = -1;
+		goto out;
+	}
+
+	entry = *pte;
+	if (entry) {
+		*pte = 0;
+		flush_task_ipa_tlb(task, va & PAGE_MASK);
+		if ((entry & MM_DESC_ADDR_MASK) != empty_zero_page)
+			task->mm.user_pages_count--;
+	}
+
+out:
+	spin_unlock(&task->mm.lock);
+
+	pa = entry & MM_DESC_ADDR_MASK;
+	if (!entry || pa == empty_zero_page)
+		return ret;
+
+	if (is_stage2_private(entry))
+		free_page(get_rasp3b_page_pool(), pa);
+	else
+		ksm_put_page(pa);
+
+	return 1;
+}
+
+/*
+ * Give dst the stage-2 view of src, with the RAM of both shared
+ * copy-on-write. A RAM block stays a block in both VMs until a VM writes
+ * to it, and is only split in src here if there are not enough items to
+ * share all of its pages. src must not run meanwhile and dst
+ * must have no tables yet. Returns -1 if dst runs out of memory halfway;
+ * what it got is freed with the rest of it by free_task_mm().
+ */
+int clone_task_mm(struct task_struct *dst, struct task_struct *src)
+{
+	uint64_t *pgd, *pmd, *pte;
+	vaddr_t va;
+	int i, j, k, ret = 0;
+
+	ksm_lock_pages();
+	spin_lock(&src->mm.lock);
+	spin_lock(&dst->mm.lock);
+
+	if (!src->mm.first_table)
+		goto out;
+
+	pgd = (uint64_t *)TO_VADDR(src->mm.first_table);
+	for (i = 0; i < PTRS_PER_TABLE; i++) {
+		if (!pgd[i])
+			continue;
+
+		pmd = (uint64_t *)TO_VADDR((pgd[i] & MM_DESC_ADDR_MASK));
+		for (j = 0; j < PTRS_PER_TABLE; j++) {
+			if (!pmd[j])
+				continue;
+
+			va = ((vaddr_t)i << (LV1_SHIFT)) |
+			     ((vaddr_t)j << (LV2_SHIFT));
+			if (is_stage2_block(pmd[j]) && !is_stage2_ram(pmd[j])) {
+				if (prepare_stage2_tables(dst, va) < 0) {
+					ret = -1;
+					goto flush;
+				}
+				map_stage2_block(dst, va, 0,
+						 MMU_STAGE2_MMIO_BLOCK_FLAGS);
+				continue;
+			}
+			if (is_stage2_block(pmd[j])) {
+				ret = clone_stage2_block(dst, va, &pmd[j]);
+				if (ret < 0)
+					goto flush;
+				if (ret == 0)
+					continue;
+				ret = split_stage2_block(src, &pmd[j], va,
+							 ALLOC_TRY);
+				if (ret < 0)
+					goto flush;
+			}
+
+			pte = stage2_pte(&pmd[j], va);
+			for (k = 0; k < PTRS_PER_TABLE; k++) {
+				if (pte[k] &&
+				    clone_stage2_page(dst, va + k * PAGE_SIZE,
+						      &pte[k]) < 0) {
+					ret = -1;
+					goto flush;
+				}
+			}
+		}
+	}
+
+	dst->mm.user_pages_count = src->mm.user_pages_count;
+
+flush:
+	flush_task_tlb(src);
+out:
+	spin_unlock(&dst->mm.lock);
+	spin_unlock(&src->mm.lock);
+	ksm_unlock_pages();
+	return ret;
+}
+
+/* Mark [begin, end) as MMIO, with blocks where the range allows. */
+void set_task_range_notaccessable(struct task_struct *task, vaddr_t begin,
+				  vaddr_t end)
+{
+	while (begin < end) {
+		if (!(begin & ~SECTION_MASK) && begin + SECTION_SIZE <= end &&
+		    map_stage2_block(task, begin, 0,
+				     MMU_STAGE2_MMIO_BLOCK_FLAGS) == 0) {
+			begin += SECTION_SIZE;
+			continue;
+		}
+		set_task_page_notaccessable(task, begin);
+		begin += PAGE_SIZE;
+	}
 }
 
 paddr_t get_ipa(vaddr_t va)
@@ -183,35 +1341,54 @@ int handle_mem_abort(vaddr_t addr, uint64_t esr)
 {
 	struct pt_regs *regs = task_pt_regs(current);
 	uint64_t dfsc = esr & ISS_ABORT_DFSC_MASK;
+	unsigned int wnr = (esr >> 6) & 0x1;
+	int ret;
 
 	if (dfsc >> 2 == 0x1) {
-		// translation fault
-		paddr_t page = get_free_page(get_rasp3b_page_pool());
+		// translation fault, reads get the zero page until written
+		paddr_t ipa = get_ipa(addr);
 
-		if (page == 0) {
-			return -1;
+		if (current->mm.ram_size && ipa >= current->mm.ram_size) {
+			WARN("VM %ld accessed 0x%lx beyond its %lu KiB of RAM",
+			     current->pid, ipa, current->mm.ram_size / 1024);
+			exit_task();
 		}
 
-		map_stage2_page(current, get_ipa(addr) & PAGE_MASK, page,
-				MMU_STAGE2_PAGE_FLAGS);
+		spin_lock(&current->mm.lock);
+		if (!wnr)
+			ret = map_stage2_zero(current, ipa);
+		else
+			ret = map_stage2_ram(current, ipa);
+		if (ret == 0)
+			map_fault_around(current, ipa, !wnr);
+		spin_unlock(&current->mm.lock);
+
+		if (ret < 0)
+			return task_out_of_memory(current, ipa);
+
 		current->stat.pf_count++;
 		return 0;
 	} else if (dfsc >> 2 == 0x3) {
-		// permission fault (mmio)
+		// permission fault (mmio, or a write to a shared page)
 		const struct board_ops *ops = current->board_ops;
 
 		//int sas = (esr >> 22) & 0x3;
 		unsigned int srt = (esr >> 16) & 0x1f;
-		unsigned int wnr = (esr >> 6) & 0x1;
+		paddr_t ipa = get_ipa(addr);
+
+		if (wnr && stage2_is_ram(current, ipa)) {
+			// retry the write on a private page
+			if (unshare_task_page(current, ipa) < 0)
+				return task_out_of_memory(current, ipa);
+			return 0;
+		}
 
 		if (wnr == 0) {
 			if (HAVE_FUNC(ops, mmio_read))
-				regs->regs[srt] =
-					ops->mmio_read(current, get_ipa(addr));
+				regs->regs[srt] = ops->mmio_read(current, ipa);
 		} else {
 			if (HAVE_FUNC(ops, mmio_write))
-				ops->mmio_write(current, get_ipa(addr),
-						regs->regs[srt]);
+				ops->mmio_write(current, ipa, regs->regs[srt]);
 		}
 
 		increment_current_pc(4);
@@ -8,53 +8,822 @@
  */
 
 #include "common/sched.h"
+#include "arch/aarch64/timer.h"
+#include "arch/aarch64/vmid.h"
 #include "common/board.h"
 #include "common/debug.h"
 #include "common/irq.h"
+#include "common/ksm.h"
 #include "common/mm.h"
 #include "common/task.h"
+#include "common/timer.h"
 #include "common/utils.h"
 
-static struct task_struct init_task = INIT_TASK;
-struct task_struct *current = &(init_task);
+static struct task_struct idle_task[NR_CPUS] = {
+	[0 ... NR_CPUS - 1] = INIT_TASK,
+};
 
 struct task_struct *task[NR_TASKS] = {
-	&(init_task),
+	&(idle_task[0]),
 };
 
 int nr_tasks = 1;
 
-void _schedule(void)
+unsigned long sched_boost_latency = SCHED_DEFAULT_BOOST_LATENCY;
+
+static struct run_queue runqueues[NR_CPUS];
+
+#define cpu_rq(cpu) (&runqueues[(cpu)])
+#define this_rq()   cpu_rq(smp_processor_id())
+
+static void init_prio_array(struct prio_array *array)
 {
-	int next, c;
+	array->bitmap = 0;
+	for (int i = 0; i < NR_PRIO; i++)
+		INIT_LIST_HEAD(&array->queue[i]);
+}
 
-	struct task_struct *p;
+void sched_init_cpu(void)
+{
+	int cpu = smp_processor_id();
+	struct run_queue *rq = cpu_rq(cpu);
+	struct task_struct *idle = &idle_task[cpu];
+
+	spin_lock_init(&rq->lock);
+	rq->cpu = cpu;
+	init_prio_array(&rq->active);
+	INIT_LIST_HEAD(&rq->sleepers);
+	INIT_LIST_HEAD(&rq->rt_tasks);
+	rq->nr_running = 0;
+	rq->acct_stamp = get_physical_timer_count();
+	rq->slice_end = 0;
+	rq->next_event = 0;
+	rq->boost_deadline = 0;
+
+	/* the hypervisor task only runs when no VM is runnable */
+	INIT_LIST_HEAD(&idle->run_list);
+	idle->cpu = cpu;
+	idle->on_cpu = 1;
+	idle->migrate_to = -1;
+	rq->idle = idle;
+	rq->curr = idle;
+
+	set_current(idle);
+}
+
+void sched_init(void)
+{
+	sched_init_cpu();
+}
+
+/*
+ * Lock the run queue @p is on. p->cpu only changes with the old run queue
+ * locked, so recheck it once the lock is held.
+ */
+static struct run_queue *task_rq_lock(struct task_struct *p)
+{
+	struct run_queue *rq;
 
 	while (1) {
-		c = -1;
-		next = 0;
+		rq = cpu_rq(p->cpu);
+		spin_lock(&rq->lock);
+		if (rq == cpu_rq(p->cpu))
+			return rq;
+		spin_unlock(&rq->lock);
+	}
+}
 
-		for (int i = 0; i < NR_TASKS; i++) {
-			p = task[i];
+void sched_init_task(struct task_struct *p)
+{
+	p->priority = CSCHED_TIMESLICE;
+	p->counter = p->priority;
+	p->adapt.policy = SCHED_DEFAULT_POLICY;
+	p->adapt.class = SCHED_CLASS_MIXED;
+	p->adapt.io = 0;
+	p->adapt.cpu = 0;
+	p->cpu = select_task_cpu();
+	p->migrate_to = -1;
+	p->csched.credit = 0;
+	p->csched.weight = CSCHED_DEFAULT_WEIGHT;
+	p->csched.cap = 0;
+	p->csched.used = 0;
+	p->csched.parked = 0;
+	p->csched.boosted = 0;
+	p->wakeup = 0;
+	p->rt.period = 0;
+	INIT_LIST_HEAD(&p->rt.list);
+}
 
-			if (p && p->state == TASK_RUNNING && p->counter > c) {
-				c = p->counter;
-				next = i;
-			}
+static int task_prio(struct task_struct *p)
+{
+	if (p->rt.period && p->rt.runtime > 0)
+		return PRIO_RT;
+
+	if (p->csched.parked)
+		return PRIO_PARKED;
+
+	if (p->csched.boosted)
+		return PRIO_BOOST;
+
+	return p->csched.credit > 0 ? PRIO_UNDER : PRIO_OVER;
+}
+
+static void enqueue_task(struct task_struct *p, struct prio_array *array)
+{
+	struct list_head *pos = &array->queue[PRIO_RT];
+
+	p->prio = task_prio(p);
+
+	if (p->prio == PRIO_RT) {
+		/* earliest deadline first */
+		list_for_each(pos, &array->queue[PRIO_RT]) {
+			struct task_struct *q =
+				list_entry(pos, struct task_struct, run_list);
+			if ((long)(p->rt.deadline - q->rt.deadline) < 0)
+				break;
 		}
+	} else {
+		pos = &array->queue[p->prio];
+	}
+
+	list_add_tail(&p->run_list, pos);
+	array->bitmap |= 1UL << p->prio;
+	p->array = array;
+}
+
+static void dequeue_task(struct task_struct *p)
+{
+	struct prio_array *array = p->array;
+
+	list_del(&p->run_list);
+	if (list_empty(&array->queue[p->prio]))
+		array->bitmap &= ~(1UL << p->prio);
+	p->array = NULL;
+}
+
+/* move @p to the tail of the level that matches its state */
+static void requeue_task(struct task_struct *p)
+{
+	struct prio_array *array = p->array;
+
+	dequeue_task(p);
+	enqueue_task(p, array);
+}
+
+/* queue @p on @rq, returns 1 if @rq's cpu has to be kicked to run it */
+static int __activate_task(struct run_queue *rq, struct task_struct *p)
+{
+	if (p->array)
+		return 0;
+
+	if (p->rt.period && list_empty(&p->rt.list))
+		list_add_tail(&p->rt.list, &rq->rt_tasks);
+
+	p->lat.ready_at = get_physical_timer_count();
+	enqueue_task(p, &rq->active);
+	rq->nr_running++;
+
+	/* I/O-bound VMs go first within their level when they wake up */
+	if (p->adapt.class == SCHED_CLASS_IO && p->prio < PRIO_BOOST) {
+		list_del(&p->run_list);
+		list_add(&p->run_list, &rq->active.queue[p->prio]);
+	}
+
+	return rq->cpu != smp_processor_id() && rq->curr == rq->idle;
+}
+
+void activate_task(struct task_struct *p)
+{
+	struct run_queue *rq = task_rq_lock(p);
+	int kick = __activate_task(rq, p);
+
+	spin_unlock(&rq->lock);
+
+	if (kick)
+		smp_send_reschedule(rq->cpu);
+}
+
+static int vcpu_interrupt_pending(struct task_struct *p)
+{
+	return (HAVE_FUNC(p->board_ops, is_irq_asserted) &&
+		p->board_ops->is_irq_asserted(p)) ||
+	       (HAVE_FUNC(p->board_ops, is_fiq_asserted) &&
+		p->board_ops->is_fiq_asserted(p));
+}
+
+/* take a blocked @p off the sleepers, with its run queue locked */
+static void unblock_task(struct task_struct *p)
+{
+	list_del(&p->run_list);
+	p->state = TASK_RUNNING;
+	p->wakeup = 0;
+
+	if (HAVE_FUNC(p->board_ops, waking_vm))
+		p->board_ops->waking_vm(p);
+}
+
+static inline unsigned long earliest(unsigned long a, unsigned long b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	return MIN(a, b);
+}
+
+/*
+ * Let @p run ahead of the best-effort VMs on @rq, which have to make way
+ * for it within sched_boost_latency. Called with @rq locked.
+ */
+static void boost_task(struct run_queue *rq, struct task_struct *p)
+{
+	p->csched.boosted = 1;
+	rq->boost_deadline = earliest(rq->boost_deadline,
+				      get_physical_timer_count() +
+					      sched_boost_latency);
+
+	if (p->array && p->prio != task_prio(p))
+		requeue_task(p);
+}
+
+static int __wake_up_task(struct run_queue *rq, struct task_struct *p)
+{
+	unsigned long now = get_physical_timer_count();
+
+	unblock_task(p);
+	boost_task(rq, p);
+
+	/* a reservation whose deadline passed while asleep starts anew */
+	if (p->rt.period && (long)(now - p->rt.deadline) >= 0) {
+		p->rt.deadline = now + p->rt.period;
+		p->rt.runtime = p->rt.budget;
+	}
+
+	return __activate_task(rq, p);
+}
+
+/*
+ * Take the current VM off the run queue until a virtual interrupt is
+ * pending, its next timer match is due or physical count @deadline (if
+ * not 0) is reached. This is what WFI does.
+ */
+void block_current(unsigned long deadline)
+{
+	struct task_struct *p = current;
+	struct run_queue *rq = this_rq();
+	struct list_head *pos;
+
+	if (HAVE_FUNC(p->board_ops, next_event))
+		deadline = earliest(deadline, p->board_ops->next_event(p));
+
+	spin_lock(&rq->lock);
+
+	/* checked with the lock held so that wake_up_task() cannot miss us */
+	if (vcpu_interrupt_pending(p) ||
+	    (deadline && deadline <= get_physical_timer_count())) {
+		spin_unlock(&rq->lock);
+		return;
+	}
+
+	if (p->migrate_to >= 0 || !p->array) {
+		spin_unlock(&rq->lock);
+		schedule();
+		return;
+	}
+
+	dequeue_task(p);
+	rq->nr_running--;
+	p->state = TASK_BLOCKED;
+	p->wakeup = deadline;
+
+	list_for_each(pos, &rq->sleepers) {
+		struct task_struct *q =
+			list_entry(pos, struct task_struct, run_list);
+		if (!q->wakeup || (deadline && deadline < q->wakeup))
+			break;
+	}
+	list_add_tail(&p->run_list, pos);
+
+	spin_unlock(&rq->lock);
+
+	schedule();
+}
+
+/*
+ * Wake @p if it is blocked, boost it if it is waiting for a cpu. A task
+ * that blocked but has not been switched out yet is still on_cpu, and is
+ * woken all the same.
+ */
+static void wake_or_boost(struct task_struct *p, int need_interrupt)
+{
+	struct run_queue *rq = task_rq_lock(p);
+	int kick;
+
+	if (p->state == TASK_ZOMBIE || p->state == TASK_PAUSED ||
+	    (need_interrupt && !vcpu_interrupt_pending(p))) {
+		spin_unlock(&rq->lock);
+		return;
+	}
+
+	if (p->state == TASK_BLOCKED)
+		__wake_up_task(rq, p);
+	else if (!p->on_cpu)
+		boost_task(rq, p);
+
+	/*
+	 * A local preemption happens in check_preempt(). A remote cpu that
+	 * is running @p picks up its virtual interrupt on the way back in.
+	 */
+	kick = rq->cpu != smp_processor_id();
+
+	spin_unlock(&rq->lock);
+
+	if (kick)
+		smp_send_reschedule(rq->cpu);
+}
 
-		if (c)
+/*
+ * An event for @p came in. If that left it with a virtual interrupt
+ * pending, get it to handle the interrupt soon.
+ */
+void wake_up_task(struct task_struct *p)
+{
+	wake_or_boost(p, 1);
+}
+
+/*
+ * Directed yield: hand the cpu to VM @pid, waking it if it is blocked. VM 0
+ * is the hypervisor. task_lock keeps the VM from being released until it
+ * is boosted.
+ */
+int yield_to(long pid)
+{
+	struct task_struct *p;
+
+	spin_lock(&task_lock);
+	p = pid > 0 && pid < nr_tasks ? task[pid] : 0;
+	if (!p || p == current || p->state == TASK_ZOMBIE) {
+		spin_unlock(&task_lock);
+		return -1;
+	}
+	wake_or_boost(p, 0);
+	spin_unlock(&task_lock);
+
+	schedule();
+	return 0;
+}
+
+/* microseconds left of the current task's slice */
+unsigned long remaining_slice(void)
+{
+	long left = this_rq()->slice_end - get_physical_timer_count();
+
+	return left > 0 ? left : 0;
+}
+
+/* wake the sleepers whose timer match is due */
+static void wake_up_sleepers(struct run_queue *rq, unsigned long now)
+{
+	struct list_head *pos, *n;
+
+	list_for_each_safe(pos, n, &rq->sleepers) {
+		struct task_struct *p =
+			list_entry(pos, struct task_struct, run_list);
+
+		if (!p->wakeup || p->wakeup > now)
 			break;
 
-		for (int i = 0; i < NR_TASKS; i++) {
-			p = task[i];
+		__wake_up_task(rq, p);
+	}
+}
+
+void deactivate_task(struct task_struct *p)
+{
+	struct run_queue *rq = task_rq_lock(p);
+
+	if (p->array) {
+		dequeue_task(p);
+		rq->nr_running--;
+	}
+	list_del(&p->rt.list);
+
+	spin_unlock(&rq->lock);
+}
+
+/* place a new task on the least loaded online cpu */
+int select_task_cpu(void)
+{
+	int best = smp_processor_id();
+
+	for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (cpu_online(cpu) &&
+		    cpu_rq(cpu)->nr_running < cpu_rq(best)->nr_running)
+			best = cpu;
+	}
+
+	return best;
+}
 
-			if (p)
-				p->counter = (p->counter >> 1) + p->priority;
+/* per mille of a cpu taken by @p's reservation */
+static unsigned long rt_task_util(struct task_struct *p)
+{
+	return p->rt.period ? p->rt.budget * 1000 / p->rt.period : 0;
+}
+
+static unsigned long rt_util(struct run_queue *rq)
+{
+	unsigned long util = 0;
+	struct list_head *pos;
+
+	list_for_each(pos, &rq->rt_tasks) {
+		util += rt_task_util(
+			list_entry(pos, struct task_struct, rt.list));
+	}
+
+	return util;
+}
+
+/*
+ * Move @p to @cpu's run queue. A task whose context is live on some cpu
+ * is only marked here, its owner moves it in schedule_tail() once it has
+ * been switched out.
+ */
+int migrate_task(struct task_struct *p, int cpu)
+{
+	if (cpu < 0 || cpu >= NR_CPUS || !cpu_online(cpu))
+		return -1;
+
+	/* admission control on the target cpu */
+	if (rt_util(cpu_rq(cpu)) + rt_task_util(p) > RT_MAX_UTIL)
+		return -1;
+
+	struct run_queue *rq = task_rq_lock(p);
+	int runnable;
+
+	if (rq->cpu == cpu) {
+		p->migrate_to = -1;
+		spin_unlock(&rq->lock);
+		return 0;
+	}
+
+	if (p->on_cpu || rq->curr == p) {
+		p->migrate_to = cpu;
+		spin_unlock(&rq->lock);
+		if (rq->cpu != smp_processor_id())
+			smp_send_reschedule(rq->cpu);
+		return 0;
+	}
+
+	/* a blocked task wakes up on its new cpu */
+	if (p->state == TASK_BLOCKED)
+		unblock_task(p);
+
+	runnable = p->state == TASK_RUNNING;
+	if (p->array) {
+		dequeue_task(p);
+		rq->nr_running--;
+	}
+	list_del(&p->rt.list);
+	p->cpu = cpu;
+	spin_unlock(&rq->lock);
+
+	if (runnable)
+		activate_task(p);
+
+	return 0;
+}
+
+/* charge the time @p has run since it was switched in */
+static void update_curr(struct run_queue *rq, struct task_struct *p)
+{
+	struct sched_credit *cs = &p->csched;
+	unsigned long now = get_physical_timer_count();
+	unsigned long delta = now - cs->exec_start;
+
+	cs->exec_start = now;
+
+	if (p == rq->idle)
+		return;
+
+	cs->credit -= delta;
+	cs->used += delta;
+
+	if (p->rt.period && p->rt.runtime > 0) {
+		p->rt.runtime -= delta;
+		/* wants more than it reserved, runs on credit until refilled */
+		if (p->rt.runtime <= 0)
+			p->stat.budget_overrun_count++;
+	}
+
+	if (cs->cap && cs->used >= CSCHED_ACCT_PERIOD * cs->cap / 100)
+		cs->parked = 1;
+}
+
+/*
+ * Hand out the time elapsed since the last accounting as credit, in
+ * proportion to the weights of the tasks on this run queue. A capped task
+ * may use cap percent of the period; usage beyond that is carried over so
+ * it stays parked until the overrun has been paid back.
+ */
+static void csched_acct(struct run_queue *rq)
+{
+	unsigned long now = get_physical_timer_count();
+	unsigned long period = now - rq->acct_stamp;
+	unsigned long total_weight = 0;
+	struct list_head *pos, *n;
+	LIST_HEAD(tasks);
+
+	rq->acct_stamp = now;
+
+	for (int prio = 0; prio < NR_PRIO; prio++) {
+		list_for_each(pos, &rq->active.queue[prio]) {
+			total_weight += list_entry(pos, struct task_struct,
+						   run_list)->csched.weight;
+		}
+	}
+
+	if (!total_weight)
+		return;
+
+	for (int prio = 0; prio < NR_PRIO; prio++) {
+		list_for_each_safe(pos, n, &rq->active.queue[prio]) {
+			struct task_struct *p =
+				list_entry(pos, struct task_struct, run_list);
+			struct sched_credit *cs = &p->csched;
+
+			cs->credit += period * cs->weight / total_weight;
+			cs->credit = MIN(cs->credit, (long)period);
+			cs->credit = MAX(cs->credit, -(long)period);
+
+			if (cs->cap) {
+				unsigned long budget = period * cs->cap / 100;
+
+				cs->used = cs->used > budget ?
+						   cs->used - budget :
+						   0;
+				cs->parked = cs->used >= budget;
+			} else {
+				cs->used = 0;
+				cs->parked = 0;
+			}
+
+			dequeue_task(p);
+			list_add_tail(&p->run_list, &tasks);
 		}
 	}
 
-	switch_to(task[next]);
+	list_for_each_safe(pos, n, &tasks) {
+		struct task_struct *p =
+			list_entry(pos, struct task_struct, run_list);
+
+		list_del(&p->run_list);
+		enqueue_task(p, &rq->active);
+	}
+}
+
+/*
+ * Start a new period for the runnable reserved tasks whose deadline has
+ * passed. One still holding budget at its deadline was not given its
+ * reservation in time.
+ */
+static void rt_replenish(struct run_queue *rq, unsigned long now)
+{
+	struct list_head *pos;
+
+	list_for_each(pos, &rq->rt_tasks) {
+		struct task_struct *p =
+			list_entry(pos, struct task_struct, rt.list);
+		struct sched_rt *rt = &p->rt;
+
+		if (!p->array || (long)(now - rt->deadline) < 0)
+			continue;
+
+		if (rt->runtime > 0)
+			p->stat.deadline_miss_count++;
+
+		rt->deadline += rt->period;
+		if ((long)(now - rt->deadline) >= 0)
+			rt->deadline = now + rt->period;
+		rt->runtime = rt->budget;
+
+		requeue_task(p);
+	}
+}
+
+/* the earliest deadline of the runnable reserved tasks on @rq */
+static unsigned long rt_next_deadline(struct run_queue *rq)
+{
+	unsigned long deadline = 0;
+	struct list_head *pos;
+
+	list_for_each(pos, &rq->rt_tasks) {
+		struct task_struct *p =
+			list_entry(pos, struct task_struct, rt.list);
+
+		if (p->array && (!deadline ||
+				 (long)(p->rt.deadline - deadline) < 0))
+			deadline = p->rt.deadline;
+	}
+
+	return deadline;
+}
+
+/* does something on @rq have to run before @curr */
+static int should_preempt(struct run_queue *rq, struct task_struct *curr)
+{
+	unsigned long bitmap = rq->active.bitmap & ~(1UL << PRIO_PARKED);
+
+	if (!bitmap)
+		return 0;
+
+	if (curr == rq->idle || !curr->array)
+		return 1;
+
+	int prio = 63 - __builtin_clzl(bitmap);
+
+	/* the running VM may use up the boost latency first */
+	if (prio == PRIO_BOOST && curr->prio < PRIO_BOOST)
+		return (long)(get_physical_timer_count() -
+			      rq->boost_deadline) >= 0;
+
+	if (prio != curr->prio)
+		return prio > curr->prio;
+
+	if (prio == PRIO_RT) {
+		struct task_struct *p = list_first_entry(
+			&rq->active.queue[PRIO_RT], struct task_struct,
+			run_list);
+		return (long)(p->rt.deadline - curr->rt.deadline) < 0;
+	}
+
+	return 0;
+}
+
+static struct task_struct *pick_next_task(struct run_queue *rq)
+{
+	unsigned long bitmap = rq->active.bitmap & ~(1UL << PRIO_PARKED);
+
+	if (!bitmap)
+		return rq->idle;
+
+	int prio = 63 - __builtin_clzl(bitmap);
+
+	return list_first_entry(&rq->active.queue[prio], struct task_struct,
+				run_list);
+}
+
+/*
+ * Pick the next slice of @p from its recent exits: short ones for VMs
+ * that mostly wait for I/O, long ones for VMs that use up their slices,
+ * so that these switch, and save and restore their state, less often.
+ */
+static void adapt_timeslice(struct task_struct *p)
+{
+	struct sched_adapt *a = &p->adapt;
+	unsigned long total = a->io + a->cpu;
+
+	if (a->policy == SCHED_POLICY_FIXED) {
+		a->class = SCHED_CLASS_MIXED;
+		p->priority = CSCHED_TIMESLICE;
+		return;
+	}
+
+	if (total) {
+		if (a->io * 4 >= total * 3)
+			a->class = SCHED_CLASS_IO;
+		else if (a->cpu * 4 >= total * 3)
+			a->class = SCHED_CLASS_CPU;
+		else
+			a->class = SCHED_CLASS_MIXED;
+	}
+
+	switch (a->class) {
+	case SCHED_CLASS_IO:
+		p->priority = CSCHED_MIN_TIMESLICE;
+		break;
+	case SCHED_CLASS_CPU:
+		p->priority = CSCHED_MAX_TIMESLICE;
+		break;
+	default:
+		p->priority = CSCHED_TIMESLICE;
+		break;
+	}
+
+	a->io /= 2;
+	a->cpu /= 2;
+}
+
+void sched_note_io(struct task_struct *p)
+{
+	p->adapt.io++;
+}
+
+void _schedule(void)
+{
+	struct run_queue *rq = this_rq();
+	struct task_struct *prev = current;
+	unsigned long t0 = rdtsc();
+	int expired;
+
+	spin_lock(&rq->lock);
+
+	update_curr(rq, prev);
+
+	/* a boost only lasts until the task is switched out */
+	prev->csched.boosted = 0;
+
+	expired = prev != rq->idle && prev->counter <= 0;
+	if (expired) {
+		adapt_timeslice(prev);
+		prev->counter = prev->priority;
+	}
+
+	if (prev->array && prev->migrate_to >= 0) {
+		/* leaves this run queue, see schedule_tail() */
+		dequeue_task(prev);
+		rq->nr_running--;
+	} else if (prev->array &&
+		   (expired || prev->prio != task_prio(prev))) {
+		requeue_task(prev);
+	}
+
+	struct task_struct *next = pick_next_task(rq);
+	rq->curr = next;
+	if (next->prio == PRIO_BOOST ||
+	    !(rq->active.bitmap & (1UL << PRIO_BOOST)))
+		rq->boost_deadline = 0;
+	next->csched.exec_start = get_physical_timer_count();
+	rq->slice_end =
+		next->csched.exec_start + next->counter * SCHED_TICK_USEC;
+
+	rq->stat.nr_schedule++;
+	rq->stat.cost += rdtsc() - t0;
+
+	spin_unlock(&rq->lock);
+
+	switch_to(next);
+}
+
+/*
+ * Finish the switch away from @prev, on the stack of the new task. on_cpu
+ * is cleared with the run queue locked so that kill_task() and this agree
+ * on who releases a task that was killed while live.
+ */
+void schedule_tail(struct task_struct *prev)
+{
+	struct run_queue *rq = task_rq_lock(prev);
+	int cpu = prev->migrate_to;
+	int runnable;
+
+	prev->on_cpu = 0;
+
+	if (prev->state == TASK_ZOMBIE) {
+		spin_unlock(&rq->lock);
+		release_task(prev);
+		return;
+	}
+
+	if (cpu < 0) {
+		spin_unlock(&rq->lock);
+		return;
+	}
+
+	/* it may have been woken up since _schedule() dequeued it */
+	if (prev->array) {
+		dequeue_task(prev);
+		rq->nr_running--;
+	}
+
+	if (prev->state == TASK_BLOCKED)
+		unblock_task(prev);
+
+	runnable = prev->state == TASK_RUNNING;
+	list_del(&prev->rt.list);
+	prev->migrate_to = -1;
+	prev->cpu = cpu;
+	spin_unlock(&rq->lock);
+
+	if (runnable)
+		activate_task(prev);
+}
+
+/*
+ * Called on the way out of every interrupt, including the reschedule
+ * IPI: switch if a woken, boosted or migrating task calls for it. The
+ * current task keeps its place and the rest of its slice.
+ */
+void check_preempt(void)
+{
+	struct run_queue *rq = this_rq();
+	struct task_struct *curr = current;
+
+	spin_lock(&rq->lock);
+	int resched = curr->migrate_to >= 0 || curr->state == TASK_ZOMBIE ||
+		      curr->state == TASK_PAUSED || should_preempt(rq, curr);
+	spin_unlock(&rq->lock);
+
+	if (resched)
+		_schedule();
 }
 
 void schedule(void)
@@ -78,43 +847,338 @@ void set_cpu_virtual_interrupt(struct task_struct *tsk)
 		clear_vfiq();
 }
 
+static void record_latency(unsigned long *hist, unsigned long delta)
+{
+	int bucket = 63 - __builtin_clzl(delta | 1);
+
+	hist[MIN(bucket, NR_LAT_BUCKETS - 1)]++;
+}
+
 void switch_to(struct task_struct *next)
 {
-	if (current == next)
+	struct task_struct *prev = current;
+	struct task_struct *idle = this_rq()->idle;
+	unsigned long now;
+
+	if (prev == next)
 		return;
 
-	struct task_struct *prev = current;
-	current = next;
+	now = get_physical_timer_count();
+	if (prev != idle) {
+		record_latency(prev->lat.slice, now - prev->lat.run_at);
+		/* preempted, it waits again from now on */
+		prev->lat.ready_at = now;
+	}
+	if (next != idle) {
+		record_latency(next->lat.wait, now - next->lat.ready_at);
+		next->lat.run_at = now;
+	}
+
+	next->on_cpu = 1;
+	set_current(next);
 
-	cpu_switch_to(prev, next);
+	prev = cpu_switch_to(prev, next);
+	schedule_tail(prev);
+}
+
+/*
+ * The next time this cpu has to look at its run queue, 0 if nothing but
+ * an interrupt can change what runs here.
+ */
+static unsigned long next_sched_event(struct run_queue *rq,
+				      struct task_struct *curr)
+{
+	unsigned long deadline = 0;
+
+	if (curr != rq->idle) {
+		struct sched_credit *cs = &curr->csched;
+		unsigned long budget = CSCHED_ACCT_PERIOD * cs->cap / 100;
+
+		/* a slice only ends if there is someone to switch to */
+		if (rq->nr_running > 1)
+			deadline = rq->slice_end;
+
+		if (cs->cap && cs->used < budget)
+			deadline = earliest(deadline,
+					    cs->exec_start + budget - cs->used);
+
+		/* reserved budget runs out */
+		if (curr->prio == PRIO_RT)
+			deadline = earliest(deadline,
+					    cs->exec_start + curr->rt.runtime);
+
+		if (HAVE_FUNC(curr->board_ops, next_event))
+			deadline = earliest(deadline,
+					    curr->board_ops->next_event(curr));
+	}
+
+	if (!list_empty(&rq->sleepers)) {
+		struct task_struct *p = list_first_entry(
+			&rq->sleepers, struct task_struct, run_list);
+		deadline = earliest(deadline, p->wakeup);
+	}
+
+	deadline = earliest(deadline, rt_next_deadline(rq));
+	deadline = earliest(deadline, rq->boost_deadline);
+
+	/* parked tasks come back at the next accounting */
+	if (rq->active.bitmap & (1UL << PRIO_PARKED))
+		deadline = earliest(deadline,
+				    rq->acct_stamp + CSCHED_ACCT_PERIOD);
+
+	return deadline;
+}
+
+/* program the one-shot scheduler timer before leaving the hypervisor */
+void sched_update_timer(void)
+{
+	struct run_queue *rq = this_rq();
+
+	spin_lock(&rq->lock);
+	unsigned long deadline = next_sched_event(rq, current);
+	if (deadline != rq->next_event) {
+		rq->next_event = deadline;
+		timer_set_next_event(deadline);
+	}
+	spin_unlock(&rq->lock);
 }
 
 void timer_tick()
 {
-	--current->counter;
+	struct run_queue *rq = this_rq();
+	struct task_struct *curr = current;
+	unsigned long now;
+	int expired = 0;
+	int resched;
+
+	spin_lock(&rq->lock);
+
+	/* the timer is one-shot, it is disarmed now */
+	rq->next_event = 0;
+
+	update_curr(rq, curr);
+	now = get_physical_timer_count();
+	if (now - rq->acct_stamp >= CSCHED_ACCT_PERIOD)
+		csched_acct(rq);
+	wake_up_sleepers(rq, now);
+	rt_replenish(rq, now);
+
+	if (curr != rq->idle) {
+		expired = (long)(now - rq->slice_end) >= 0;
+		if (expired)
+			curr->adapt.cpu++;
+	}
+
+	/* slice over, ran out of credit or budget, hit the cap, preempted */
+	resched = expired || (curr->array && curr->prio != task_prio(curr)) ||
+		  should_preempt(rq, curr);
 
-	if (current->counter > 0)
+	spin_unlock(&rq->lock);
+
+	if (!resched)
 		return;
 
-	current->counter = 0;
+	if (expired)
+		curr->counter = 0;
 	_schedule();
 }
 
-void exit_task()
+void cpu_idle(void)
 {
-	for (int i = 0; i < NR_TASKS; i++) {
-		if (task[i] == current) {
-			task[i]->state = TASK_ZOMBIE;
-			break;
-		}
+	while (1) {
+		disable_irq();
+		schedule();
+		sched_update_timer();
+		/* one page at a time, so a pending interrupt waits that long */
+		if (!zero_free_page() && !ksm_scan_page())
+			wait_for_interrupt();
+		enable_irq();
+	}
+}
+
+/*
+ * Stop @p for good. Its memory is released right away if its context is
+ * not live on any cpu, otherwise by schedule_tail() once it is switched
+ * out. If @p is the task this cpu interrupted, that happens in
+ * check_preempt(); only exit_task() switches away on the spot.
+ */
+int kill_task(struct task_struct *p)
+{
+	struct run_queue *rq = task_rq_lock(p);
+	int live, kick;
+
+	if (p->state == TASK_ZOMBIE) {
+		spin_unlock(&rq->lock);
+		return -1;
 	}
 
+	if (p->array) {
+		dequeue_task(p);
+		rq->nr_running--;
+	} else if (p->state == TASK_BLOCKED) {
+		list_del(&p->run_list);
+	}
+	list_del(&p->rt.list);
+	p->state = TASK_ZOMBIE;
+	p->migrate_to = -1;
+
+	live = p->on_cpu || rq->curr == p;
+	kick = live && rq->cpu != smp_processor_id();
+	spin_unlock(&rq->lock);
+
+	if (!live)
+		release_task(p);
+	else if (kick)
+		smp_send_reschedule(rq->cpu);
+
+	return 0;
+}
+
+/*
+ * Take @p off the cpus until resume_task() and wait until its context is
+ * saved. If @p is the task this cpu interrupted, it is saved already and
+ * is switched out in check_preempt().
+ */
+int pause_task(struct task_struct *p)
+{
+	struct run_queue *rq = task_rq_lock(p);
+	int live;
+
+	if (p->state == TASK_ZOMBIE || p->state == TASK_PAUSED) {
+		spin_unlock(&rq->lock);
+		return -1;
+	}
+
+	if (p->array) {
+		dequeue_task(p);
+		rq->nr_running--;
+	} else if (p->state == TASK_BLOCKED) {
+		list_del(&p->run_list);
+	}
+	p->state = TASK_PAUSED;
+
+	live = p->on_cpu || rq->curr == p;
+	spin_unlock(&rq->lock);
+
+	if (!live || p == current)
+		return 0;
+
+	smp_send_reschedule(rq->cpu);
+	do {
+		rq = task_rq_lock(p);
+		live = p->on_cpu || rq->curr == p;
+		spin_unlock(&rq->lock);
+	} while (live);
+
+	return 0;
+}
+
+void resume_task(struct task_struct *p)
+{
+	struct run_queue *rq = task_rq_lock(p);
+
+	if (p->state != TASK_PAUSED) {
+		spin_unlock(&rq->lock);
+		return;
+	}
+	p->state = TASK_RUNNING;
+	spin_unlock(&rq->lock);
+
+	activate_task(p);
+}
+
+/* the current task never returns from here */
+void exit_task()
+{
+	kill_task(current);
 	schedule();
 }
 
+int sched_set_weight(struct task_struct *p, unsigned int weight)
+{
+	if (weight == 0 || weight > CSCHED_MAX_WEIGHT)
+		return -1;
+
+	struct run_queue *rq = task_rq_lock(p);
+	p->csched.weight = weight;
+	spin_unlock(&rq->lock);
+
+	return 0;
+}
+
+int sched_set_cap(struct task_struct *p, unsigned int cap)
+{
+	if (cap > 100)
+		return -1;
+
+	struct run_queue *rq = task_rq_lock(p);
+	p->csched.cap = cap;
+	p->csched.used = 0;
+	if (p->csched.parked) {
+		p->csched.parked = 0;
+		if (p->array)
+			requeue_task(p);
+	}
+	spin_unlock(&rq->lock);
+
+	return 0;
+}
+
+int sched_set_policy(struct task_struct *p, int policy)
+{
+	if (policy != SCHED_POLICY_FIXED && policy != SCHED_POLICY_ADAPTIVE)
+		return -1;
+
+	struct run_queue *rq = task_rq_lock(p);
+	p->adapt.policy = policy;
+	/* takes effect from the next slice */
+	spin_unlock(&rq->lock);
+
+	return 0;
+}
+
+/*
+ * Give @p @budget out of every @period microseconds, or drop its
+ * reservation if @period is 0. Fails if the reservations on its cpu
+ * would take more than RT_MAX_UTIL.
+ */
+int sched_set_reservation(struct task_struct *p, unsigned long budget,
+			  unsigned long period)
+{
+	if (period && (period < RT_MIN_PERIOD || !budget || budget > period))
+		return -1;
+
+	struct run_queue *rq = task_rq_lock(p);
+	unsigned long util = rt_util(rq);
+
+	if (!list_empty(&p->rt.list))
+		util -= rt_task_util(p);
+
+	if (period && util + budget * 1000 / period > RT_MAX_UTIL) {
+		spin_unlock(&rq->lock);
+		return -1;
+	}
+
+	list_del(&p->rt.list);
+	p->rt.budget = budget;
+	p->rt.period = period;
+	p->rt.deadline = get_physical_timer_count() + period;
+	p->rt.runtime = budget;
+
+	if (period && p->state != TASK_ZOMBIE)
+		list_add_tail(&p->rt.list, &rq->rt_tasks);
+
+	if (p->array)
+		requeue_task(p);
+
+	spin_unlock(&rq->lock);
+
+	return 0;
+}
+
 void set_cpu_sysregs(struct task_struct *tsk)
 {
-	set_stage2_pgd(tsk->mm.first_table, tsk->pid);
+	set_stage2_pgd(tsk->mm.first_table, update_vmid(tsk));
 	restore_sysregs(&tsk->cpu_sysregs);
 }
 
@@ -126,6 +1190,7 @@ void vm_entering_work()
 	if (is_uart_forwarded_task(current))
 		flush_task_console(current);
 
+	sched_update_timer();
 	set_cpu_sysregs(current);
 	set_cpu_virtual_interrupt(current);
 }
@@ -144,21 +1209,85 @@ void vm_leaving_work()
 const char *task_state_str[] = {
 	"RUNNING",
 	"ZOMBIE",
+	"BLOCKED",
+	"PAUSED",
 };
 
+static const char *task_class_str(struct task_struct *tsk)
+{
+	static const char *class_str[] = { "mixed", "io", "cpu" };
+
+	if (tsk->adapt.policy == SCHED_POLICY_FIXED)
+		return "fixed";
+
+	return class_str[tsk->adapt.class];
+}
+
 void show_task_list(void)
 {
-	printf("%3s %12s %8s %7s %8s %7s %7s %7s %7s %7s\n", "id", "name",
-	       "state", "pages", "saved-pc", "wfx", "hvc", "sysreg", "pf",
-	       "mmio");
+	printf("%3s %12s %8s %3s %6s %4s %9s %6s %6s "
+	       "%7s %6s %7s %6s %8s "
+	       "%7s %7s %7s %7s %7s %7s %5s %5s %5s\n",
+	       "id", "name", "state", "cpu", "weight", "cap", "credit", "policy",
+	       "slice", "pages", "tables", "limit", "rsv", "saved-pc", "wfx",
+	       "hvc", "sysreg", "pf", "fa", "mmio", "ovr", "miss", "oom");
 
 	for (int i = 0; i < nr_tasks; i++) {
 		struct task_struct *tsk = task[i];
-		printf("%3d %12s %8s %7d %8x %7d %7d %7d %7d %7d\n", tsk->pid,
-		       tsk->name ? tsk->name : "", task_state_str[tsk->state],
-		       tsk->mm.user_pages_count, task_pt_regs(tsk)->pc,
+		if (!tsk)
+			continue;
+		printf("%3ld %12s %8s %3d %6u %3u%% %9ld %6s %4ldms "
+		       "%7d %6d %7lu %6lu %8lx "
+		       "%7ld %7ld %7ld %7ld %7ld %7ld %5ld %5ld %5ld\n",
+		       tsk->pid, tsk->name ? tsk->name : "",
+		       task_state_str[tsk->state], tsk->cpu,
+		       tsk->csched.weight, tsk->csched.cap, tsk->csched.credit,
+		       task_class_str(tsk),
+		       tsk->priority * SCHED_TICK_USEC / 1000,
+		       tsk->mm.user_pages_count, tsk->mm.kernel_pages_count,
+		       tsk->mm.max_pages, tsk->mm.reserved_pages,
+		       task_pt_regs(tsk)->pc,
 		       tsk->stat.wfx_trap_count, tsk->stat.hvc_trap_count,
 		       tsk->stat.sysreg_trap_count, tsk->stat.pf_count,
-		       tsk->stat.mmio_count);
+		       tsk->stat.fault_around_count, tsk->stat.mmio_count,
+		       tsk->stat.budget_overrun_count,
+		       tsk->stat.deadline_miss_count, tsk->stat.oom_count);
+	}
+
+	for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct run_queue *rq = cpu_rq(cpu);
+		struct sched_stat *stat = &rq->stat;
+
+		if (!cpu_online(cpu))
+			continue;
+
+		printf("cpu%d: %lu runnable, %lu picks, avg pick cost %lu ticks\n",
+		       cpu, rq->nr_running, stat->nr_schedule,
+		       stat->nr_schedule ? stat->cost / stat->nr_schedule : 0);
+	}
+}
+
+static void show_latency_hist(const char *title, unsigned long *hist)
+{
+	printf("%s (us):\n", title);
+
+	for (int i = 0; i < NR_LAT_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("  %8lu - %8lu: %lu\n", i ? 1UL << i : 0,
+		       (1UL << (i + 1)) - 1, hist[i]);
 	}
 }
+
+void show_task_latency(struct task_struct *tsk)
+{
+	printf("VM %ld (%s)\n", tsk->pid, tsk->name);
+	show_latency_hist("run queue wait", tsk->lat.wait);
+	show_latency_hist("slice length", tsk->lat.slice);
+}
+
+void reset_task_latency(struct task_struct *tsk)
+{
+	memzero(tsk->lat.wait, sizeof(tsk->lat.wait));
+	memzero(tsk->lat.slice, sizeof(tsk->lat.slice));
+}
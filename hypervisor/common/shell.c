@@ -8,10 +8,15 @@
  */
 
 #include "common/shell.h"
+#include "boards/raspi/raspi3b.h"
+#include "common/balloon.h"
 #include "common/errno.h"
+#include "common/ksm.h"
+#include "common/membench.h"
 #include "common/mini_uart.h"
 #include "common/mm.h"
 #include "common/printf.h"
+#include "common/slab.h"
 #include "common/task.h"
 #include "common/utils.h"
 #include "common/loader.h"
@@ -34,6 +39,22 @@ static int32_t shell_cmd_vml(__unused int32_t argc, __unused char **argv);
 static int32_t shell_cmd_vmc(int32_t argc, char **argv);
 static int32_t shell_cmd_vmld(int32_t argc, char **argv);
 static int32_t shell_cmd_ls(int32_t argc, char **argv);
+static int32_t shell_cmd_vmkill(int32_t argc, char **argv);
+static int32_t shell_cmd_vmclone(int32_t argc, char **argv);
+static int32_t shell_cmd_vmmig(int32_t argc, char **argv);
+static int32_t shell_cmd_vmweight(int32_t argc, char **argv);
+static int32_t shell_cmd_vmcap(int32_t argc, char **argv);
+static int32_t shell_cmd_vmrt(int32_t argc, char **argv);
+static int32_t shell_cmd_vmlat(int32_t argc, char **argv);
+static int32_t shell_cmd_boost(int32_t argc, char **argv);
+static int32_t shell_cmd_vmpolicy(int32_t argc, char **argv);
+static int32_t shell_cmd_vmfa(int32_t argc, char **argv);
+static int32_t shell_cmd_vmksm(int32_t argc, char **argv);
+static int32_t shell_cmd_vmballoon(int32_t argc, char **argv);
+static int32_t shell_cmd_vmquota(int32_t argc, char **argv);
+static int32_t shell_cmd_vmreserve(int32_t argc, char **argv);
+static int32_t shell_cmd_mem(__unused int32_t argc, __unused char **argv);
+static int32_t shell_cmd_membench(__unused int32_t argc, __unused char **argv);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -66,6 +87,102 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str = SHELL_CMD_LS_HELP,
 		.fcn = shell_cmd_ls,
 	},
+	{
+		.str = SHELL_CMD_VMKILL,
+		.cmd_param = SHELL_CMD_VMKILL_PARAM,
+		.help_str = SHELL_CMD_VMKILL_HELP,
+		.fcn = shell_cmd_vmkill,
+	},
+	{
+		.str = SHELL_CMD_VMCLONE,
+		.cmd_param = SHELL_CMD_VMCLONE_PARAM,
+		.help_str = SHELL_CMD_VMCLONE_HELP,
+		.fcn = shell_cmd_vmclone,
+	},
+	{
+		.str = SHELL_CMD_VMMIG,
+		.cmd_param = SHELL_CMD_VMMIG_PARAM,
+		.help_str = SHELL_CMD_VMMIG_HELP,
+		.fcn = shell_cmd_vmmig,
+	},
+	{
+		.str = SHELL_CMD_VMWEIGHT,
+		.cmd_param = SHELL_CMD_VMWEIGHT_PARAM,
+		.help_str = SHELL_CMD_VMWEIGHT_HELP,
+		.fcn = shell_cmd_vmweight,
+	},
+	{
+		.str = SHELL_CMD_VMCAP,
+		.cmd_param = SHELL_CMD_VMCAP_PARAM,
+		.help_str = SHELL_CMD_VMCAP_HELP,
+		.fcn = shell_cmd_vmcap,
+	},
+	{
+		.str = SHELL_CMD_VMRT,
+		.cmd_param = SHELL_CMD_VMRT_PARAM,
+		.help_str = SHELL_CMD_VMRT_HELP,
+		.fcn = shell_cmd_vmrt,
+	},
+	{
+		.str = SHELL_CMD_VMLAT,
+		.cmd_param = SHELL_CMD_VMLAT_PARAM,
+		.help_str = SHELL_CMD_VMLAT_HELP,
+		.fcn = shell_cmd_vmlat,
+	},
+	{
+		.str = SHELL_CMD_BOOST,
+		.cmd_param = SHELL_CMD_BOOST_PARAM,
+		.help_str = SHELL_CMD_BOOST_HELP,
+		.fcn = shell_cmd_boost,
+	},
+	{
+		.str = SHELL_CMD_VMPOLICY,
+		.cmd_param = SHELL_CMD_VMPOLICY_PARAM,
+		.help_str = SHELL_CMD_VMPOLICY_HELP,
+		.fcn = shell_cmd_vmpolicy,
+	},
+	{
+		.str = SHELL_CMD_VMFA,
+		.cmd_param = SHELL_CMD_VMFA_PARAM,
+		.help_str = SHELL_CMD_VMFA_HELP,
+		.fcn = shell_cmd_vmfa,
+	},
+	{
+		.str = SHELL_CMD_VMKSM,
+		.cmd_param = SHELL_CMD_VMKSM_PARAM,
+		.help_str = SHELL_CMD_VMKSM_HELP,
+		.fcn = shell_cmd_vmksm,
+	},
+	{
+		.str = SHELL_CMD_VMBALLOON,
+		.cmd_param = SHELL_CMD_VMBALLOON_PARAM,
+		.help_str = SHELL_CMD_VMBALLOON_HELP,
+		.fcn = shell_cmd_vmballoon,
+	},
+	{
+		.str = SHELL_CMD_VMQUOTA,
+		.cmd_param = SHELL_CMD_VMQUOTA_PARAM,
+		.help_str = SHELL_CMD_VMQUOTA_HELP,
+		.fcn = shell_cmd_vmquota,
+	},
+	{
+		.str = SHELL_CMD_VMRESERVE,
+		.cmd_param = SHELL_CMD_VMRESERVE_PARAM,
+		.help_str = SHELL_CMD_VMRESERVE_HELP,
+		.fcn = shell_cmd_vmreserve,
+	},
+	{
+		.str = SHELL_CMD_MEM,
+		.cmd_param = SHELL_CMD_MEM_PARAM,
+		.help_str = SHELL_CMD_MEM_HELP,
+		.fcn = shell_cmd_mem,
+	},
+	{
+		.str = SHELL_CMD_MEMBENCH,
+		.cmd_param = SHELL_CMD_MEMBENCH_PARAM,
+		.help_str = SHELL_CMD_MEMBENCH_HELP,
+		.fcn = shell_cmd_membench,
+	},
 };
 
 static struct shell hv_shell;
@@ -476,7 +593,7 @@ static int32_t shell_cmd_vmc(int32_t argc, char **argv)
 	if (tsk_id == 0)
 		return 0;
 
-	if (tsk_id > nr_tasks - 1)
+	if (tsk_id > nr_tasks - 1 || !task[tsk_id])
 		return -EINVAL;
 
 	/* Output that switching to Service VM shell */
@@ -493,14 +610,16 @@ static int32_t shell_cmd_vmc(int32_t argc, char **argv)
 	return CODE_AVOID_SHELL_PROMPT_STR;
 }
 
-struct raw_binary_loader_args bl_args;
 static int32_t shell_cmd_vmld(int32_t argc, char **argv)
 {
+	struct raw_binary_loader_args bl_args = { 0 };
 	uint64_t load_addr;
 	uint64_t entry_addr;
+	int64_t mem_mb = 0;
+	int prefault = 0;
 	char *end;
 
-	if (argc != 4)
+	if (argc < 4 || argc > 6)
 		return -EINVAL;
 
 	load_addr = strtoul(argv[2], &end, 16);
@@ -515,11 +634,33 @@ static int32_t shell_cmd_vmld(int32_t argc, char **argv)
 		return -EINVAL;
 	}
 
+	if (argc >= 5) {
+		/* prefault has to get all of it from the pool */
+		int64_t max_mb =
+			MIN(HIGH_MEMORY,
+			    get_rasp3b_page_pool()->page_nr * PAGE_SIZE) /
+			(1024 * 1024);
+
+		mem_mb = strtol_deci(argv[4]);
+		if (mem_mb <= 0 || mem_mb > max_mb) {
+			printf("Error: mem size must be 1-%ld MiB!\n", max_mb);
+			return -EINVAL;
+		}
+	}
+
+	if (argc == 6) {
+		if (strcmp(argv[5], "prefault") != 0)
+			return -EINVAL;
+		prefault = 1;
+	}
+
 	(void)strncpy(bl_args.filename, argv[1], 36);
 	bl_args.load_addr = load_addr;
 	bl_args.entry_point = entry_addr;
+	bl_args.mem_size = mem_mb * 1024 * 1024;
+	bl_args.prefault = prefault;
 
-	if (create_task(raw_binary_loader, &bl_args) < 0) {
+	if (create_raw_binary_task(&bl_args) < 0) {
 		printf("error while starting task\n");
 		return -EFAULT;
 	}
@@ -533,6 +674,7 @@ static int32_t shell_cmd_ls(int32_t argc, char **argv)
 	FRESULT res;
 	FILINFO fno;
 
+	spin_lock(&fs_lock);
 	f_opendir(&dir, "/");
 
 	while(1) {
@@ -555,6 +697,341 @@ static int32_t shell_cmd_ls(int32_t argc, char **argv)
 	}
 
 	f_closedir(&dir);
+	spin_unlock(&fs_lock);
 	return 0;
 }
 
+static int32_t shell_cmd_vmkill(int32_t argc, char **argv)
+{
+	int64_t tsk_id;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	/* VM 0 is the hypervisor */
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	return kill_task(task[tsk_id]) < 0 ? -EINVAL : 0;
+}
+
+static int32_t shell_cmd_vmclone(int32_t argc, char **argv)
+{
+	int64_t tsk_id;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (clone_task(task[tsk_id]) < 0) {
+		printf("Error: can't clone VM %ld!\n", tsk_id);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmmig(int32_t argc, char **argv)
+{
+	int64_t tsk_id, cpu;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	cpu = strtol_deci(argv[2]);
+
+	/* VM 0 is the hypervisor */
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (migrate_task(task[tsk_id], cpu) < 0) {
+		printf("Error: cpu %d is offline or its reservations are full!\n",
+		       cpu);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmweight(int32_t argc, char **argv)
+{
+	int64_t tsk_id, weight;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	weight = strtol_deci(argv[2]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (weight <= 0 || sched_set_weight(task[tsk_id], weight) < 0) {
+		printf("Error: weight must be 1-%d!\n", CSCHED_MAX_WEIGHT);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmcap(int32_t argc, char **argv)
+{
+	int64_t tsk_id, cap;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	cap = strtol_deci(argv[2]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (cap < 0 || sched_set_cap(task[tsk_id], cap) < 0) {
+		printf("Error: cap must be 0-100!\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmrt(int32_t argc, char **argv)
+{
+	int64_t tsk_id, budget, period;
+
+	if (argc != 4)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	budget = strtol_deci(argv[2]);
+	period = strtol_deci(argv[3]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (budget < 0 || period < 0 ||
+	    sched_set_reservation(task[tsk_id], budget, period) < 0) {
+		printf("Error: need 0 < budget <= period, period >= %dus "
+		       "and at most %d/1000 of the cpu reserved!\n",
+		       RT_MIN_PERIOD, RT_MAX_UTIL);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmlat(int32_t argc, char **argv)
+{
+	int64_t tsk_id;
+
+	if (argc != 2 && argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (argc == 3) {
+		if (strcmp(argv[2], "reset") != 0)
+			return -EINVAL;
+		reset_task_latency(task[tsk_id]);
+		return 0;
+	}
+
+	show_task_latency(task[tsk_id]);
+
+	return 0;
+}
+
+static int32_t shell_cmd_boost(int32_t argc, char **argv)
+{
+	int64_t latency;
+
+	if (argc == 1) {
+		printf("boost latency: %lu us\n", sched_boost_latency);
+		return 0;
+	}
+
+	if (argc != 2)
+		return -EINVAL;
+
+	latency = strtol_deci(argv[1]);
+	if (latency < 0)
+		return -EINVAL;
+
+	sched_boost_latency = latency;
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmpolicy(int32_t argc, char **argv)
+{
+	int64_t tsk_id;
+	int policy;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (strcmp(argv[2], "fixed") == 0)
+		policy = SCHED_POLICY_FIXED;
+	else if (strcmp(argv[2], "adaptive") == 0)
+		policy = SCHED_POLICY_ADAPTIVE;
+	else
+		return -EINVAL;
+
+	return sched_set_policy(task[tsk_id], policy) < 0 ? -EINVAL : 0;
+}
+
+static int32_t shell_cmd_vmfa(int32_t argc, char **argv)
+{
+	int64_t tsk_id, pages;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	pages = strtol_deci(argv[2]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (set_fault_around(task[tsk_id], pages) < 0) {
+		printf("Error: pages must be a power of 2, 1-%d!\n",
+		       PTRS_PER_TABLE);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmksm(int32_t argc, char **argv)
+{
+	int64_t tsk_id;
+	int on;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (strcmp(argv[2], "on") == 0)
+		on = 1;
+	else if (strcmp(argv[2], "off") == 0)
+		on = 0;
+	else
+		return -EINVAL;
+
+	ksm_set_task(task[tsk_id], on);
+	return 0;
+}
+
+static int32_t shell_cmd_vmballoon(int32_t argc, char **argv)
+{
+	int64_t tsk_id, pages;
+	struct task_struct *tsk;
+
+	if (argc != 2 && argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	tsk = task[tsk_id];
+	if (argc == 2) {
+		printf("VM %ld balloon: %lu of %lu pages\n", tsk_id,
+		       tsk->mm.balloon_pages, tsk->mm.balloon_target);
+		return 0;
+	}
+
+	pages = strtol_deci(argv[2]);
+	if (pages < 0 || balloon_set_target(tsk, pages) < 0) {
+		printf("Error: the balloon can't be larger than the VM's RAM!\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_vmquota(int32_t argc, char **argv)
+{
+	int64_t tsk_id, pages, tables;
+	int policy = MM_OOM_KILL;
+
+	if (argc != 4 && argc != 5)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	pages = strtol_deci(argv[2]);
+	tables = strtol_deci(argv[3]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (pages < 0 || tables < 0)
+		return -EINVAL;
+
+	if (argc == 5) {
+		if (strcmp(argv[4], "kill") == 0)
+			policy = MM_OOM_KILL;
+		else if (strcmp(argv[4], "wait") == 0)
+			policy = MM_OOM_WAIT;
+		else
+			return -EINVAL;
+	}
+
+	set_task_limits(task[tsk_id], pages, tables, policy);
+	return 0;
+}
+
+static int32_t shell_cmd_vmreserve(int32_t argc, char **argv)
+{
+	int64_t tsk_id, pages;
+
+	if (argc != 3)
+		return -EINVAL;
+
+	tsk_id = strtol_deci(argv[1]);
+	pages = strtol_deci(argv[2]);
+
+	if (tsk_id <= 0 || tsk_id > nr_tasks - 1 || !task[tsk_id])
+		return -EINVAL;
+
+	if (pages < 0 || set_task_reservation(task[tsk_id], pages) < 0) {
+		printf("Error: not enough free pages to reserve!\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int32_t shell_cmd_mem(__unused int32_t argc, __unused char **argv)
+{
+	show_mem_stat();
+	show_slab_stat();
+	show_ksm_stat();
+	return 0;
+}
+
+static int32_t shell_cmd_membench(__unused int32_t argc, __unused char **argv)
+{
+	mem_bench();
+	return 0;
+}
@@ -49,10 +49,75 @@ struct shell {
 	"Switch to the VM's console. Use [@0] to return to the aVisor console"
 
 #define SHELL_CMD_VMLD	     "vmld"
-#define SHELL_CMD_VMLD_PARAM "<image file name> <load addr> <entry addr>"
-#define SHELL_CMD_VMLD_HELP  "Load the VM image and run it"
+#define SHELL_CMD_VMLD_PARAM \
+	"<image file name> <load addr> <entry addr> [mem MiB [prefault]]"
+#define SHELL_CMD_VMLD_HELP \
+	"Load the VM image and run it, with RAM mapped up front if prefault"
 
 #define SHELL_CMD_LS	     "ls"
 #define SHELL_CMD_LS_PARAM   NULL
 #define SHELL_CMD_LS_HELP    "List files in current folder"
 
+#define SHELL_CMD_VMKILL	 "vmkill"
+#define SHELL_CMD_VMKILL_PARAM "<vm id>"
+#define SHELL_CMD_VMKILL_HELP  "Stop the VM and free all of its memory"
+
+#define SHELL_CMD_VMCLONE	"vmclone"
+#define SHELL_CMD_VMCLONE_PARAM "<vm id>"
+#define SHELL_CMD_VMCLONE_HELP	"Fork a VM, sharing its memory copy-on-write"
+
+#define SHELL_CMD_VMMIG	      "vmmig"
+#define SHELL_CMD_VMMIG_PARAM "<vm id> <cpu id>"
+#define SHELL_CMD_VMMIG_HELP  "Migrate the VM to another cpu"
+
+#define SHELL_CMD_VMWEIGHT	 "vmweight"
+#define SHELL_CMD_VMWEIGHT_PARAM "<vm id> <weight>"
+#define SHELL_CMD_VMWEIGHT_HELP  "Set the VM's cpu share weight (1-65535)"
+
+#define SHELL_CMD_VMCAP	      "vmcap"
+#define SHELL_CMD_VMCAP_PARAM "<vm id> <cap>"
+#define SHELL_CMD_VMCAP_HELP  "Cap the VM to a percentage of a cpu, 0 for none"
+
+#define SHELL_CMD_VMRT	     "vmrt"
+#define SHELL_CMD_VMRT_PARAM "<vm id> <budget us> <period us>"
+#define SHELL_CMD_VMRT_HELP  "Reserve cpu time for the VM each period, 0 0 for none"
+
+#define SHELL_CMD_VMLAT	      "vmlat"
+#define SHELL_CMD_VMLAT_PARAM "<vm id> [reset]"
+#define SHELL_CMD_VMLAT_HELP  "Show or reset the VM's scheduling latency histograms"
+
+#define SHELL_CMD_BOOST	      "boost"
+#define SHELL_CMD_BOOST_PARAM "[latency us]"
+#define SHELL_CMD_BOOST_HELP  "Show or set how soon a VM with a new interrupt must run"
+
+#define SHELL_CMD_VMPOLICY	 "vmpolicy"
+#define SHELL_CMD_VMPOLICY_PARAM "<vm id> <fixed|adaptive>"
+#define SHELL_CMD_VMPOLICY_HELP  "Set the VM's timeslice policy"
+
+#define SHELL_CMD_VMFA	     "vmfa"
+#define SHELL_CMD_VMFA_PARAM "<vm id> <pages>"
+#define SHELL_CMD_VMFA_HELP  "Set how many pages around a VM's page fault get mapped"
+
+#define SHELL_CMD_VMKSM	      "vmksm"
+#define SHELL_CMD_VMKSM_PARAM "<vm id> <on|off>"
+#define SHELL_CMD_VMKSM_HELP  "Let a VM's pages be merged with identical pages"
+
+#define SHELL_CMD_VMBALLOON	  "vmballoon"
+#define SHELL_CMD_VMBALLOON_PARAM "<vm id> [pages]"
+#define SHELL_CMD_VMBALLOON_HELP  "Show or set how many pages a VM should give back"
+
+#define SHELL_CMD_VMQUOTA	"vmquota"
+#define SHELL_CMD_VMQUOTA_PARAM "<vm id> <pages> <table pages> [kill|wait]"
+#define SHELL_CMD_VMQUOTA_HELP	"Limit a VM's memory, 0 for no limit, and what a fault over it does"
+
+#define SHELL_CMD_VMRESERVE	  "vmreserve"
+#define SHELL_CMD_VMRESERVE_PARAM "<vm id> <pages>"
+#define SHELL_CMD_VMRESERVE_HELP  "Hold pages back for a VM that other VMs can't take"
+
+#define SHELL_CMD_MEM	    "mem"
+#define SHELL_CMD_MEM_PARAM NULL
+#define SHELL_CMD_MEM_HELP  "Show free pages per buddy order and page merging"
+
+#define SHELL_CMD_MEMBENCH	 "membench"
+#define SHELL_CMD_MEMBENCH_PARAM NULL
+#define SHELL_CMD_MEMBENCH_HELP	 "Measure memcpy/memmove/memset/memzero bytes per cycle"
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#include "common/slab.h"
+#include "common/debug.h"
+#include "common/printf.h"
+#include "common/utils.h"
+
+/*
+ * Slab allocator for hypervisor objects smaller than a page. A slab is a
+ * buddy block of SLAB_ORDER, which the buddy allocator aligns to its size,
+ * so the header at its start is found by masking an object's address.
+ * Free objects are chained through their first word.
+ *
+ * Locking order: a cache's lock, then the list of caches or the page pool.
+ */
+
+struct slab {
+	struct list_head list; // on the partial or full list of its cache
+	struct kmem_cache *cache;
+	void *free; // first free object
+	unsigned int inuse;
+};
+
+static LIST_HEAD(slab_caches);
+static DEFINE_SPINLOCK(slab_lock);
+
+static struct kmem_cache kmalloc_caches[] = {
+	KMEM_CACHE_INIT(kmalloc_caches[0], "kmalloc-32", 32),
+	KMEM_CACHE_INIT(kmalloc_caches[1], "kmalloc-64", 64),
+	KMEM_CACHE_INIT(kmalloc_caches[2], "kmalloc-96", 96),
+	KMEM_CACHE_INIT(kmalloc_caches[3], "kmalloc-128", 128),
+	KMEM_CACHE_INIT(kmalloc_caches[4], "kmalloc-192", 192),
+	KMEM_CACHE_INIT(kmalloc_caches[5], "kmalloc-256", 256),
+	KMEM_CACHE_INIT(kmalloc_caches[6], "kmalloc-512", 512),
+	KMEM_CACHE_INIT(kmalloc_caches[7], "kmalloc-1024", 1024),
+	KMEM_CACHE_INIT(kmalloc_caches[8], "kmalloc-2048", 2048),
+	KMEM_CACHE_INIT(kmalloc_caches[9], "kmalloc-4096", KMALLOC_MAX_SIZE),
+};
+
+#define NR_KMALLOC_CACHES (sizeof(kmalloc_caches) / sizeof(kmalloc_caches[0]))
+
+static inline struct slab *obj_to_slab(void *obj)
+{
+	return (struct slab *)((unsigned long)obj & ~(SLAB_SIZE - 1UL));
+}
+
+static inline unsigned int objs_per_slab(struct kmem_cache *cache)
+{
+	return (SLAB_SIZE - SLAB_HEADER_SIZE) / cache->size;
+}
+
+/* Add an empty slab to the cache. Called with the cache locked. */
+static int grow_cache(struct kmem_cache *cache, unsigned int flags)
+{
+	struct slab *slab;
+	uint8_t *obj;
+	unsigned int i, n = objs_per_slab(cache);
+
+	slab = allocate_pages(SLAB_ORDER, ALLOC_NOZERO);
+	if (!slab) {
+		if (!(flags & ALLOC_TRY))
+			PANIC("no memory for a %s slab!\n", cache->name);
+		return -1;
+	}
+
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->free = NULL;
+	obj = (uint8_t *)slab + SLAB_HEADER_SIZE + (n - 1) * cache->size;
+	for (i = 0; i < n; i++, obj -= cache->size) {
+		*(void **)obj = slab->free;
+		slab->free = obj;
+	}
+	list_add(&slab->list, &cache->partial);
+
+	if (!cache->nr_slabs++ && list_empty(&cache->list)) {
+		spin_lock(&slab_lock);
+		list_add_tail(&cache->list, &slab_caches);
+		spin_unlock(&slab_lock);
+	}
+
+	return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache, unsigned int flags)
+{
+	struct slab *slab;
+	void *obj;
+
+	spin_lock(&cache->lock);
+
+	if (list_empty(&cache->partial) && grow_cache(cache, flags) < 0) {
+		spin_unlock(&cache->lock);
+		return NULL;
+	}
+
+	slab = list_first_entry(&cache->partial, struct slab, list);
+	obj = slab->free;
+	slab->free = *(void **)obj;
+	if (++slab->inuse == objs_per_slab(cache)) {
+		list_del(&slab->list);
+		list_add(&slab->list, &cache->full);
+	}
+	cache->nr_active++;
+	cache->nr_allocs++;
+
+	spin_unlock(&cache->lock);
+
+	if (!(flags & ALLOC_NOZERO))
+		memzero(obj, cache->size);
+	return obj;
+}
+
+/*
+ * Give the object back to its slab. An empty slab goes back to the pool,
+ * unless it is the last one of the cache.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct slab *slab = obj_to_slab(obj);
+
+	spin_lock(&cache->lock);
+
+	if (slab->inuse == objs_per_slab(cache)) {
+		list_del(&slab->list);
+		list_add(&slab->list, &cache->partial);
+	}
+	*(void **)obj = slab->free;
+	slab->free = obj;
+	slab->inuse--;
+	cache->nr_active--;
+
+	if (!slab->inuse && cache->nr_slabs > 1) {
+		list_del(&slab->list);
+		cache->nr_slabs--;
+		spin_unlock(&cache->lock);
+		deallocate_pages(slab, SLAB_ORDER);
+		return;
+	}
+
+	spin_unlock(&cache->lock);
+}
+
+void *kmalloc(unsigned long size, unsigned int flags)
+{
+	int i;
+
+	for (i = 0; i < NR_KMALLOC_CACHES; i++) {
+		if (size <= kmalloc_caches[i].size)
+			return kmem_cache_alloc(&kmalloc_caches[i], flags);
+	}
+
+	if (!(flags & ALLOC_TRY))
+		PANIC("kmalloc of %lu bytes!\n", size);
+	return NULL;
+}
+
+void kfree(void *obj)
+{
+	if (obj)
+		kmem_cache_free(obj_to_slab(obj)->cache, obj);
+}
+
+void show_slab_stat(void)
+{
+	struct kmem_cache *cache;
+	struct list_head *pos;
+
+	printf("%16s %7s %8s %8s %6s %9s\n", "cache", "objsize", "active",
+	       "total", "slabs", "allocs");
+
+	spin_lock(&slab_lock);
+	list_for_each(pos, &slab_caches) {
+		cache = list_entry(pos, struct kmem_cache, list);
+		printf("%16s %7lu %8lu %8lu %6lu %9lu\n", cache->name,
+		       cache->size, cache->nr_active,
+		       cache->nr_slabs * objs_per_slab(cache), cache->nr_slabs,
+		       cache->nr_allocs);
+	}
+	spin_unlock(&slab_lock);
+}
@@ -72,14 +72,6 @@ int strncmp(const char *s1, const char *s2, size_t n)
 	return (i != n) ? (*s1 - *s2) : 0;
 }
 
-void *memset(void *s, int c, size_t n)
-{
-	for (size_t i = 0; i < n; i++)
-		*(uint8_t *)s++ = (uint8_t)c;
-
-	return s;
-}
-
 int memcmp(const void *s1, const void *s2, size_t n)
 {
 	size_t i;
@@ -98,21 +90,6 @@ int memcmp(const void *s1, const void *s2, size_t n)
 		return *p1 - *p2;
 }
 
-void *memmove(void *dest, const void *src, size_t n)
-{
-	if (src + n > dest) {
-		src += n - 1;
-		dest += n - 1;
-
-		for (size_t i = 0; i < n; i++)
-			*(uint8_t *)dest-- = *(uint8_t *)src--;
-	} else {
-		memcpy(dest, src, n);
-	}
-
-	return dest;
-}
-
 void *memchr(const void *s, int c, size_t n)
 {
 	uint8_t *p = (uint8_t *)s;
@@ -17,6 +17,7 @@
 #include "common/debug.h"
 #include "common/fifo.h"
 #include "common/mm.h"
+#include "common/slab.h"
 #include "common/timer.h"
 #include "common/utils.h"
 #include "emulator/raspi/bcm2837.h"
@@ -56,6 +57,7 @@ struct bcm2837_state {
 		uint64_t c1_64;
 		uint64_t c2_64;
 		uint64_t c3_64;
+		uint64_t next_event; // physical count of the upcoming match
 	} systimer;
 };
 
@@ -96,18 +98,30 @@ const struct bcm2837_state initial_state = {
 
 void bcm2837_initialize(struct task_struct *tsk)
 {
-	struct bcm2837_state *s = (struct bcm2837_state *)allocate_page();
+	struct bcm2837_state *s = kmalloc(sizeof(*s), ALLOC_NOZERO);
 	*s = initial_state;
 
 	s->systimer.last_physical_count = get_physical_timer_count();
 
 	tsk->board_data = s;
 
-	unsigned long begin = DEVICE_BASE;
-	unsigned long end = PHYS_MEMORY_SIZE - SECTION_SIZE;
-	for (; begin < end; begin += PAGE_SIZE) {
-		set_task_page_notaccessable(tsk, begin);
-	}
+	set_task_range_notaccessable(tsk, DEVICE_BASE,
+				     PHYS_MEMORY_SIZE - SECTION_SIZE);
+}
+
+void bcm2837_destroy(struct task_struct *tsk)
+{
+	kfree(tsk->board_data);
+	tsk->board_data = NULL;
+}
+
+/* the MMIO mappings come with the stage-2 tables, see clone_task_mm() */
+void bcm2837_clone(struct task_struct *tsk, struct task_struct *src)
+{
+	struct bcm2837_state *s = kmalloc(sizeof(*s), ALLOC_NOZERO);
+	*s = *(struct bcm2837_state *)src->board_data;
+
+	tsk->board_data = s;
 }
 
 unsigned long handle_aux_read(struct task_struct *, unsigned long);
@@ -413,6 +427,7 @@ unsigned long bcm2837_mmio_read(struct task_struct *tsk, unsigned long addr)
 	if (ADDR_IN_INTCTRL(addr)) {
 		return handle_intctrl_read(tsk, addr);
 	} else if (ADDR_IN_AUX(addr)) {
+		sched_note_io(tsk);
 		return handle_aux_read(tsk, addr);
 	} else if (ADDR_IN_SYSTIMER(addr)) {
 		return handle_systimer_read(tsk, addr);
@@ -430,6 +445,7 @@ void bcm2837_mmio_write(struct task_struct *tsk, unsigned long addr,
 	if (ADDR_IN_INTCTRL(addr)) {
 		handle_intctrl_write(tsk, addr, val);
 	} else if (ADDR_IN_AUX(addr)) {
+		sched_note_io(tsk);
 		handle_aux_write(tsk, addr, val);
 	} else if (ADDR_IN_SYSTIMER(addr)) {
 		handle_systimer_write(tsk, addr, val);
@@ -488,7 +504,9 @@ void bcm2837_entering_vm(struct task_struct *tsk)
 		upcoming = (uint32_t)c3x;
 
 	if (upcoming != 0xffffffff)
-		put32(TIMER_C3, get32(TIMER_CLO) + upcoming);
+		s->systimer.next_event = current_physical_count + upcoming;
+	else
+		s->systimer.next_event = 0;
 
 	int fired = (~s->systimer.cs) & matched;
 	s->systimer.cs |= fired;
@@ -500,6 +518,28 @@ void bcm2837_leaving_vm(struct task_struct *tsk)
 	s->systimer.last_physical_count = get_physical_timer_count();
 }
 
+/* time spent blocked in WFI is not hidden from the guest */
+void bcm2837_waking_vm(struct task_struct *tsk)
+{
+	struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+	s->systimer.last_physical_count = get_physical_timer_count();
+}
+
+/* the scheduler timer fires for the upcoming match, see sched_update_timer() */
+unsigned long bcm2837_next_event(struct task_struct *tsk)
+{
+	struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+	return s->systimer.next_event;
+}
+
+/* convert a count of the guest's system timer to the physical one */
+unsigned long bcm2837_to_physical_count(struct task_struct *tsk,
+					unsigned long count)
+{
+	struct bcm2837_state *s = (struct bcm2837_state *)tsk->board_data;
+	return TO_PHYSICAL_COUNT(s, count);
+}
+
 int bcm2837_is_irq_asserted(struct task_struct *tsk)
 {
 	return handle_intctrl_read(tsk, IRQ_BASIC_PENDING) != 0;
@@ -533,10 +573,15 @@ void bcm2837_debug(struct task_struct *tsk)
 
 const struct board_ops bcm2837_board_ops = {
 	.initialize = bcm2837_initialize,
+	.destroy = bcm2837_destroy,
+	.clone = bcm2837_clone,
 	.mmio_read = bcm2837_mmio_read,
 	.mmio_write = bcm2837_mmio_write,
 	.entering_vm = bcm2837_entering_vm,
 	.leaving_vm = bcm2837_leaving_vm,
+	.waking_vm = bcm2837_waking_vm,
+	.next_event = bcm2837_next_event,
+	.to_physical_count = bcm2837_to_physical_count,
 	.is_irq_asserted = bcm2837_is_irq_asserted,
 	.is_fiq_asserted = bcm2837_is_fiq_asserted,
 	.debug = bcm2837_debug,
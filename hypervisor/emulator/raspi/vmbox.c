@@ -13,7 +13,9 @@
 #include "boards/raspi/base.h"
 #include "boards/raspi/phys2bus.h"
 #include "common/errno.h"
+#include "common/mm.h"
 #include "common/debug.h"
+#include "common/utils.h"
 
 /*
  * TODO:
@@ -28,6 +30,8 @@
 static volatile uint32_t *mbox;
 static uint32_t mbox_val = 0;
 
+#define MBOX_EMULATED_SIZE (8 * sizeof(uint32_t)) // mbox[0] to mbox[7]
+
 enum {
 	VIDEOCORE_MBOX = (DEVICE_BASE + 0x0000B880),
 	MBOX_READ = (VIDEOCORE_MBOX + 0x0),
@@ -54,7 +58,13 @@ static uint64_t emulate_mbox_read(struct task_struct *tsk)
          * mbox[5] and mbox[6] are val.
          * mbox[7] is end tag (= 0).
          */
-	if ((mbox_val & 0xF) == MBOX_CHAN_TAGS && mbox[1] == MBOX_REQUEST) {
+	if ((mbox_val & 0xF) != MBOX_CHAN_TAGS)
+		return mbox_val;
+
+	/* the VM may access the buffer with its caches off */
+	dcache_clean_inval_range((void *)mbox, MBOX_EMULATED_SIZE);
+
+	if (mbox[1] == MBOX_REQUEST) {
 		switch (mbox[2]) {
 		case MBOX_TAG_GET_ARM_MEMORY:
 			mbox[1] = MBOX_RESPONSE;
@@ -77,6 +87,7 @@ static uint64_t emulate_mbox_read(struct task_struct *tsk)
 		default:
 			WARN("Unsupported mbox TAG:%x\n", mbox[2]);
 		}
+		dcache_clean_inval_range((void *)mbox, MBOX_EMULATED_SIZE);
 	}
 
 	return mbox_val;
@@ -97,6 +108,13 @@ static uint64_t emulate_mbox_write(struct task_struct *tsk, uint64_t val)
 		return -EFAULT;
 	}
 
+	/* the reply is written in place, so the page must not be shared */
+	if (unshare_task_page(tsk, gva) < 0) {
+		WARN("VM %ld has no page for the mbox reply", tsk->pid);
+		mbox_val = 0;
+		return -ENOMEM;
+	}
+
 	err = gvirt_to_maddr(gva, &maddr, GV2M_WRITE);
 	mbox = (uint32_t *)maddr;
 
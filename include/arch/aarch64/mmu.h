@@ -12,6 +12,11 @@
 #define MM_TYPE_PAGE_TABLE 0x3
 #define MM_TYPE_PAGE	   0x3
 #define MM_TYPE_BLOCK	   0x1
+#define MM_DESC_TYPE_MASK  0x3
+
+/* output address and attribute bits of a block or page descriptor */
+#define MM_DESC_ADDR_MASK 0x0000fffffffff000
+#define MM_DESC_ATTR_MASK 0xfff0000000000ffc
 
 #define MM_ACCESS (1 << 10)
 #define MM_nG	  (0 << 11)
@@ -23,13 +28,13 @@
  *   n = AttrIndx[2:0]
  *			n	MAIR
  *   DEVICE_nGnRnE	    000	00000000
- *   NORMAL_CACHEABLE		001	11111111
+ *   NORMAL_CACHEABLE		001	11111111 (write-back, r/w-allocate)
  */
 #define MT_DEVICE_nGnRnE    0x0
 #define MT_NORMAL_CACHEABLE 0x1
 
 #define MT_DEVICE_nGnRnE_FLAGS	  0x00
-#define MT_NORMAL_CACHEABLE_FLAGS 0x44 //TODO: temp. non-cacheable
+#define MT_NORMAL_CACHEABLE_FLAGS 0xff
 
 #define MAIR_VALUE                                           \
 	(MT_DEVICE_nGnRnE_FLAGS << (8 * MT_DEVICE_nGnRnE)) | \
@@ -43,18 +48,31 @@
 #define MM_STAGE2_ACCESS  (1 << 10)
 #define MM_STAGE2_SH	  (3 << 8)
 #define MM_STAGE2_AP	  (3 << 6)
-#define MM_STAGE2_MEMATTR (0x5 << 2) //TODO: temp. non-cacheable
+#define MM_STAGE2_MEMATTR (0xf << 2) // normal, inner and outer write-back
 
 #define MMU_STAGE2_PAGE_FLAGS                                            \
 	(MM_TYPE_PAGE | MM_STAGE2_ACCESS | MM_STAGE2_SH | MM_STAGE2_AP | \
 	 MM_STAGE2_MEMATTR)
 
+#define MMU_STAGE2_BLOCK_FLAGS \
+	((MMU_STAGE2_PAGE_FLAGS & ~MM_DESC_TYPE_MASK) | MM_TYPE_BLOCK)
+
 #define MM_STAGE2_AP_NONE	 (0 << 6)
+#define MM_STAGE2_AP_RO		 (1 << 6)
 #define MM_STAGE2_DEVICE_MEMATTR (0x0 << 2)
 #define MMU_STAGE2_MMIO_PAGE_FLAGS                                            \
 	(MM_TYPE_PAGE | MM_STAGE2_ACCESS | MM_STAGE2_SH | MM_STAGE2_AP_NONE | \
 	 MM_STAGE2_DEVICE_MEMATTR)
+#define MMU_STAGE2_MMIO_BLOCK_FLAGS \
+	((MMU_STAGE2_MMIO_PAGE_FLAGS & ~MM_DESC_TYPE_MASK) | MM_TYPE_BLOCK)
+
+/* guest RAM shared between mappings, a write takes a permission fault */
+#define MMU_STAGE2_RO_PAGE_FLAGS \
+	((MMU_STAGE2_PAGE_FLAGS & ~MM_STAGE2_AP) | MM_STAGE2_AP_RO)
 
 #define TCR_T0SZ   (64 - 48)
+#define TCR_IRGN0  (1 << 8) // table walks are write-back cacheable
+#define TCR_ORGN0  (1 << 10)
+#define TCR_SH0	   (3 << 12) // inner shareable
 #define TCR_TG0_4K (0 << 14)
-#define TCR_VALUE  (TCR_T0SZ | TCR_TG0_4K)
+#define TCR_VALUE  (TCR_T0SZ | TCR_IRGN0 | TCR_ORGN0 | TCR_SH0 | TCR_TG0_4K)
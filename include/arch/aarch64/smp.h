@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+struct task_struct;
+
+static inline int smp_processor_id(void)
+{
+	unsigned long mpidr;
+	asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+	return mpidr & 0xff;
+}
+
+/* TPIDR_EL2 holds the task running on this cpu */
+static inline struct task_struct *get_current(void)
+{
+	struct task_struct *tsk;
+	asm volatile("mrs %0, tpidr_el2" : "=r"(tsk));
+	return tsk;
+}
+
+static inline void set_current(struct task_struct *tsk)
+{
+	asm volatile("msr tpidr_el2, %0" : : "r"(tsk));
+}
+
+static inline void send_event(void)
+{
+	asm volatile("dsb sy; sev" : : : "memory");
+}
+
+static inline void wait_for_interrupt(void)
+{
+	asm volatile("dsb sy; wfi" : : : "memory");
+}
@@ -15,7 +15,9 @@
 
 #define SCTLR_EE	       (0 << 25)
 #define SCTLR_I_CACHE_DISABLED (0 << 12)
+#define SCTLR_I_CACHE_ENABLED  (1 << 12)
 #define SCTLR_D_CACHE_DISABLED (0 << 2)
+#define SCTLR_D_CACHE_ENABLED  (1 << 2)
 #define SCTLR_MMU_DISABLED     (0 << 0)
 #define SCTLR_MMU_ENABLED      (1 << 0)
 
@@ -23,6 +25,10 @@
 	(SCTLR_EE | SCTLR_I_CACHE_DISABLED | SCTLR_D_CACHE_DISABLED | \
 	 SCTLR_MMU_DISABLED)
 
+#define SCTLR_VALUE_MMU_ENABLED                                     \
+	(SCTLR_EE | SCTLR_I_CACHE_ENABLED | SCTLR_D_CACHE_ENABLED | \
+	 SCTLR_MMU_ENABLED)
+
 // ***************************************
 // HCR_EL2, Hypervisor Configuration Register (EL2)
 // ***************************************
@@ -78,8 +84,8 @@
 #define VTCR_PS	   (2 << 16)
 #define VTCR_TG0   (0 << 14) // 4KB
 #define VTCR_SH0   (3 << 12)
-#define VTCR_ORGN0 (0 << 10)
-#define VTCR_IRGN0 (0 << 8)
+#define VTCR_ORGN0 (1 << 10) // table walks are write-back cacheable
+#define VTCR_IRGN0 (1 << 8)
 #define VTCR_SL0   (1 << 6)
 #define VTCR_T0SZ  (64 - 38)
 
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+#define VMID_BITS 8 // VTCR_EL2.VS is 0
+#define VMID_NR	  (1UL << VMID_BITS)
+#define VMID_MASK (VMID_NR - 1)
+
+/* mm.vmid is the generation in the high bits and the VMID in the low ones */
+#define VMID_FIRST_GENERATION VMID_NR
+
+struct task_struct;
+
+unsigned long update_vmid(struct task_struct *);
+void flush_task_tlb(struct task_struct *);
+void flush_task_ipa_tlb(struct task_struct *, unsigned long);
@@ -13,3 +13,7 @@
 
 #define DEVICE_BASE 0x3F000000
 #define PBASE	    (VA_START + DEVICE_BASE)
+
+/* ARM local peripherals (per-core timers, mailboxes, interrupt routing) */
+#define LOCAL_BASE 0x40000000
+#define LPBASE	   (VA_START + LOCAL_BASE)
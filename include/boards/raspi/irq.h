@@ -27,3 +27,16 @@
 #define SYSTEM_TIMER_IRQ_2_BIT (1 << 2)
 #define SYSTEM_TIMER_IRQ_3_BIT (1 << 3)
 #define AUX_IRQ_BIT	       (1 << 29)
+
+#define CORE_TIMER_IRQCNTL(n) (LPBASE + 0x40 + 4 * (n))
+#define CORE_MBOX_IRQCNTL(n)  (LPBASE + 0x50 + 4 * (n))
+#define CORE_IRQ_SOURCE(n)    (LPBASE + 0x60 + 4 * (n))
+#define CORE_MBOX_SET(n, m)   (LPBASE + 0x80 + 0x10 * (n) + 4 * (m))
+#define CORE_MBOX_RDCLR(n, m) (LPBASE + 0xC0 + 0x10 * (n) + 4 * (m))
+
+#define CORE_TIMER_CNTHP_IRQ (1 << 2)
+#define CORE_MBOX0_IRQ	     (1 << 0)
+
+#define CORE_IRQ_CNTHP (1 << 2)
+#define CORE_IRQ_MBOX0 (1 << 4)
+#define CORE_IRQ_GPU   (1 << 8)
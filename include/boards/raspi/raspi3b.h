@@ -9,15 +9,31 @@
 
 #pragma once
 
+#include "common/list.h"
 #include "common/mm.h"
+#include "common/spinlock.h"
 #include "common/types.h"
 
+struct free_area {
+	struct list_head free_list; // linked through the free blocks themselves
+	uint64_t nr_free; // blocks of this order
+};
+
+/*
+ * Buddy allocator over [start_addr, start_addr + page_nr * PAGE_SIZE). The
+ * memap byte of a page is PAGE_BUDDY | order if the page heads a free
+ * block, 0 otherwise. Pages on the zeroed list are not on the buddy lists.
+ */
 struct page_pool {
 	paddr_t start_addr;
-	// spinlock_t lock;	// TODO: need a lock
+	spinlock_t lock;
 	uint64_t page_nr;
 	uint8_t *memap;
-	uint64_t last_page_id;
+	struct free_area free_area[MAX_ORDER];
+	struct list_head zeroed; // single pages zeroed while idle
+	uint64_t nr_zeroed;
+	uint64_t nr_free; // pages on the buddy lists
+	uint64_t nr_reserved; // reservations of all VMs, used or not
 };
 
 struct page_pool *get_rasp3b_page_pool(void);
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+#include "common/mm.h"
+
+int balloon_set_target(struct task_struct *, unsigned long);
+long balloon_inflate(struct task_struct *, vaddr_t);
+long balloon_deflate(struct task_struct *, vaddr_t);
+int balloon_clone_task(struct task_struct *dst, struct task_struct *src);
+void balloon_exit_task(struct task_struct *);
@@ -15,10 +15,15 @@
 
 struct board_ops {
 	void (*initialize)(struct task_struct *);
+	void (*destroy)(struct task_struct *);
+	void (*clone)(struct task_struct *, struct task_struct *);
 	unsigned long (*mmio_read)(struct task_struct *, unsigned long);
 	void (*mmio_write)(struct task_struct *, unsigned long, unsigned long);
 	void (*entering_vm)(struct task_struct *);
 	void (*leaving_vm)(struct task_struct *);
+	void (*waking_vm)(struct task_struct *);
+	unsigned long (*next_event)(struct task_struct *);
+	unsigned long (*to_physical_count)(struct task_struct *, unsigned long);
 	int (*is_irq_asserted)(struct task_struct *);
 	int (*is_fiq_asserted)(struct task_struct *);
 	void (*debug)(struct task_struct *);
@@ -14,6 +14,7 @@ struct fifo;
 int is_empty_fifo(struct fifo *);
 int is_full_fifo(struct fifo *);
 struct fifo *create_fifo(void);
+void destroy_fifo(struct fifo *);
 void clear_fifo(struct fifo *fifo);
 int enqueue_fifo(struct fifo *, unsigned long);
 int dequeue_fifo(struct fifo *, unsigned long *);
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+/*
+ * Paravirtual scheduling and memory ABI. The guest issues "hvc #0" with
+ * the call number in x8 and the argument in x0; the result is returned in
+ * x0, -1 on error.
+ */
+#define HVC_SCHED_YIELD		  0 // give up the rest of the slice
+#define HVC_SCHED_YIELD_TO	  1 // x0: id of the VM to run instead
+#define HVC_SCHED_SLEEP_UNTIL	  2 // x0: system timer count to wake at
+#define HVC_SCHED_REMAINING_SLICE 3 // returns microseconds left of the slice
+
+/* memory balloon, see hypervisor/common/balloon.c */
+#define HVC_BALLOON_TARGET  4 // returns the pages the balloon should hold
+#define HVC_BALLOON_INFLATE 5 // x0: guest physical page handed over
+#define HVC_BALLOON_DEFLATE 6 // x0: guest physical page taken back
@@ -10,6 +10,8 @@
 #pragma once
 
 void enable_interrupt_controller(void);
+void enable_ipi(void);
+void send_ipi(int cpu);
 
 void irq_vector_init(void);
 void enable_irq(void);
@@ -0,0 +1,28 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+#include "common/mm.h"
+
+#define KSM_PASS_INTERVAL 1000000 // microseconds between full scans
+
+struct task_struct;
+
+void ksm_init(void);
+int ksm_scan_page(void);
+void ksm_set_task(struct task_struct *, int);
+void ksm_exit_task(struct task_struct *);
+int ksm_break_cow(struct task_struct *, vaddr_t);
+void ksm_put_page(paddr_t);
+void ksm_lock_pages(void);
+void ksm_unlock_pages(void);
+int __ksm_share_page(paddr_t);
+void __ksm_unshare_page(paddr_t, bool);
+void show_ksm_stat(void);
@@ -10,13 +10,19 @@
 #pragma once
 
 #include "common/sched.h"
+#include "common/spinlock.h"
 #include "common/task.h"
 
+extern spinlock_t fs_lock;
+
 struct raw_binary_loader_args {
 	unsigned long load_addr;
 	unsigned long entry_point;
 	unsigned long sp;
+	unsigned long mem_size; // bytes of guest RAM, 0 if unbounded
+	int prefault; // map all of mem_size before the first entry
 	char filename[36];
 };
 
 int raw_binary_loader(void *, struct pt_regs *regs);
+int create_raw_binary_task(const struct raw_binary_loader_args *);
@@ -22,6 +22,7 @@
 
 #define PAGE_SIZE    (1 << PAGE_SHIFT)
 #define SECTION_SIZE (1 << SECTION_SHIFT)
+#define SECTION_MASK 0xffffffffffe00000
 
 #define LOW_MEMORY  (2 * SECTION_SIZE)
 #define HIGH_MEMORY DEVICE_BASE
@@ -29,6 +30,23 @@
 #define PAGING_MEMORY (HIGH_MEMORY - LOW_MEMORY)
 #define PAGING_PAGES  (PAGING_MEMORY / PAGE_SIZE)
 
+/* buddy blocks are 2^order pages, order MAX_ORDER - 1 is 4 MiB */
+#define MAX_ORDER 11
+
+#define STAGE2_BLOCK_ORDER (SECTION_SHIFT - PAGE_SHIFT) // a level 2 block
+
+#define ZEROED_PAGES 256 // single pages idle cpus keep zeroed ahead of faults
+
+/* allocation flags */
+#define ALLOC_NOZERO 0x1 // the caller overwrites the whole block
+#define ALLOC_TRY    0x2 // return 0 rather than panic when out of pages
+
+#define FAULT_AROUND_PAGES 16 // default pages mapped per translation fault
+
+/* what a VM's fault gets when it is over its limits or the pool is empty */
+#define MM_OOM_KILL 0 // the VM is killed
+#define MM_OOM_WAIT 1 // the VM yields and retries the access
+
 #define PTRS_PER_TABLE (1 << TABLE_SHIFT)
 
 #define PGD_SHIFT PAGE_SHIFT + 3 * TABLE_SHIFT
@@ -53,13 +71,43 @@ typedef uint64_t vaddr_t;
 
 void map_stage2_page(struct task_struct *task, vaddr_t va, paddr_t page,
 		     uint64_t flags);
+int map_stage2_block(struct task_struct *task, vaddr_t va, paddr_t block,
+		     uint64_t flags);
+void mm_init(void);
 void *allocate_page(void);
 void deallocate_page(void *);
+void *allocate_pages(int order, unsigned int flags);
+void deallocate_pages(void *, int order);
 void *allocate_task_page(struct task_struct *task, vaddr_t va);
 bool check_task_page_mapped(struct task_struct *task, vaddr_t va);
 void set_task_page_notaccessable(struct task_struct *task, vaddr_t va);
+int populate_task_ram(struct task_struct *task);
+void free_task_mm(struct task_struct *task);
+int clone_task_mm(struct task_struct *dst, struct task_struct *src);
+int unmap_task_page(struct task_struct *task, vaddr_t va);
+int set_fault_around(struct task_struct *task, int pages);
+void set_task_limits(struct task_struct *task, unsigned long max_pages,
+		     unsigned long max_table_pages, int oom_policy);
+int set_task_reservation(struct task_struct *task, unsigned long pages);
+bool may_alloc_task_pages(struct task_struct *task, unsigned long pages,
+			  unsigned long tables);
+void set_task_range_notaccessable(struct task_struct *task, vaddr_t begin,
+				  vaddr_t end);
+paddr_t stage2_private_page(struct task_struct *task, vaddr_t va,
+			    vaddr_t *next);
+paddr_t stage2_readonly_page(struct task_struct *task, vaddr_t va);
+paddr_t stage2_wrprotect_page(struct task_struct *task, vaddr_t va);
+int stage2_split_shared_block(struct task_struct *task, vaddr_t va);
+void stage2_make_writable(struct task_struct *task, vaddr_t va);
+void stage2_replace_page(struct task_struct *task, vaddr_t va, paddr_t page,
+			 uint64_t flags);
+bool stage2_is_ram(struct task_struct *task, vaddr_t va);
+int unshare_task_page(struct task_struct *task, vaddr_t va);
 int handle_mem_abort(vaddr_t addr, uint64_t esr);
+int zero_free_page(void);
+void show_mem_stat(void);
 
 extern paddr_t pg_dir;
+extern paddr_t empty_zero_page;
 
 #endif
@@ -12,6 +12,10 @@
 #define THREAD_CPU_CONTEXT 0 // offset of cpu_context in task_struct
 
 #ifndef __ASSEMBLER__
+#include "common/list.h"
+#include "common/smp.h"
+#include "common/spinlock.h"
+
 #define THREAD_SIZE 4096
 
 #define NR_TASKS 64
@@ -21,11 +25,49 @@
 
 #define TASK_RUNNING 0
 #define TASK_ZOMBIE  1
+#define TASK_BLOCKED 2 // waiting in WFI for a virtual interrupt
+#define TASK_PAUSED  3 // off the cpus until resume_task()
+
+/* credit scheduler run queue levels, a higher level is picked first */
+#define PRIO_PARKED 0 // capped VMs that used up their share, never picked
+#define PRIO_OVER   1 // VMs that ran beyond their fair share
+#define PRIO_UNDER  2 // VMs with credit left
+#define PRIO_BOOST  3 // VMs that just got a virtual interrupt
+#define PRIO_RT     4 // VMs with reservation budget left, earliest deadline first
+#define NR_PRIO	    (PRIO_RT + 1)
+
+#define CSCHED_DEFAULT_WEIGHT 256
+#define CSCHED_MAX_WEIGHT     65535
+#define CSCHED_TIMESLICE      40 // default ticks per slice
+#define CSCHED_MIN_TIMESLICE  2 // for I/O-bound VMs
+#define CSCHED_MAX_TIMESLICE  80 // for CPU-bound VMs
+#define CSCHED_ACCT_PERIOD    (3 * CSCHED_TIMESLICE * SCHED_TICK_USEC)
+
+#define SCHED_DEFAULT_BOOST_LATENCY 0 // microseconds, 0 to preempt at once
+
+#define SCHED_TICK_USEC 10000 // a tick is the unit of counter and priority
+
+/* timeslice policies */
+#define SCHED_POLICY_FIXED    0 // every VM gets CSCHED_TIMESLICE
+#define SCHED_POLICY_ADAPTIVE 1 // slices follow the VM's exit mix
+#define SCHED_DEFAULT_POLICY  SCHED_POLICY_ADAPTIVE
+
+/* what the adaptive policy made of a VM */
+#define SCHED_CLASS_MIXED 0
+#define SCHED_CLASS_IO	  1
+#define SCHED_CLASS_CPU	  2
+
+#define NR_LAT_BUCKETS 24 // bucket n counts [2^n, 2^(n+1)) microseconds
+
+#define RT_MIN_PERIOD 1000 // microseconds
+#define RT_MAX_UTIL   900 // per mille of a cpu that reservations may take
 
 struct board_ops;
-extern struct task_struct *current;
+
+#define current get_current()
 extern struct task_struct *task[NR_TASKS];
 extern int nr_tasks;
+extern spinlock_t task_lock; // slots of task[] and nr_tasks
 
 struct cpu_context {
 	unsigned long x19;
@@ -122,10 +164,26 @@ struct cpu_sysregs {
 	unsigned long cntv_tval_el0;
 };
 
+#define STAGE2_LEVELS 3 // tables one stage-2 walk goes through
+
 struct mm_struct {
 	unsigned long first_table;
 	int user_pages_count;
 	int kernel_pages_count;
+	unsigned long ram_size; // guest RAM is [0, ram_size), 0 if unbounded
+	int fault_around; // pages mapped per translation fault, a power of 2
+	int ksm; // pages may be merged with identical ones
+	unsigned long balloon_target; // pages the VM is asked to give back
+	unsigned long balloon_pages; // pages it has given back
+	struct list_head balloon_list; // their IPAs, see common/balloon.c
+	unsigned long max_pages; // RAM pages it may map, 0 if unlimited
+	unsigned long max_table_pages; // stage-2 table pages, 0 if unlimited
+	unsigned long reserved_pages; // pages the pool holds back for it
+	int oom_policy; // MM_OOM_*, when a fault can't get a page
+	unsigned long vmid; // generation | VMID, see arch/aarch64/vmid.c
+	int nr_table_cache;
+	unsigned long table_cache[STAGE2_LEVELS]; // tables a fault may need
+	spinlock_t lock; // stage-2 tables, against the KSM scanner
 };
 
 struct task_stat {
@@ -133,7 +191,57 @@ struct task_stat {
 	long hvc_trap_count;
 	long sysreg_trap_count;
 	long pf_count;
+	long fault_around_count; // pages mapped ahead of a fault
 	long mmio_count;
+	long budget_overrun_count;
+	long deadline_miss_count;
+	long oom_count; // faults refused for want of memory
+};
+
+/*
+ * Credit scheduler state. Credit and usage are in physical timer counts
+ * (microseconds).
+ */
+struct sched_credit {
+	long credit; // share left in this accounting period
+	unsigned int weight; // relative share of the cpu
+	unsigned int cap; // max percentage of a cpu, 0 if uncapped
+	unsigned long used; // time charged against the cap
+	unsigned long exec_start; // when the task was last switched in
+	int parked; // over its cap until the next accounting period
+	int boosted; // runs at PRIO_BOOST until it is next switched out
+};
+
+/*
+ * A (budget, period) reservation, in physical timer counts. The task runs
+ * at PRIO_RT until it has used its budget, and gets it back at each
+ * deadline, which is also the start of its next period.
+ */
+struct sched_rt {
+	unsigned long budget;
+	unsigned long period; // 0 if the task has no reservation
+	unsigned long deadline;
+	long runtime; // budget left in this period
+	struct list_head list; // on the run queue's rt_tasks
+};
+
+/* scheduling latency histograms, see record_latency() */
+struct sched_latency {
+	unsigned long wait[NR_LAT_BUCKETS]; // runnable until switched in
+	unsigned long slice[NR_LAT_BUCKETS]; // switched in until out
+	unsigned long ready_at; // physical count when it became runnable
+	unsigned long run_at; // physical count when it was switched in
+};
+
+/*
+ * Recent exit mix of a VM, halved each time its slice is refilled: I/O
+ * exits (WFI, yields, UART accesses) against slices run to the end.
+ */
+struct sched_adapt {
+	int policy;
+	int class;
+	unsigned long io;
+	unsigned long cpu;
 };
 
 struct task_console {
@@ -147,7 +255,7 @@ struct task_struct {
 	long counter;
 	long priority;
 	long preempt_count;
-	long pid; // used as VMID
+	long pid;
 	unsigned long flags;
 	char name[36];
 	const struct board_ops *board_ops;
@@ -156,19 +264,90 @@ struct task_struct {
 	struct cpu_sysregs cpu_sysregs;
 	struct task_stat stat;
 	struct task_console console;
+	struct list_head run_list;
+	struct prio_array *array; // the prio_array this task is queued on
+	int prio;
+	int cpu; // the cpu whose run queue holds this task
+	int on_cpu; // set while the task's context is live on a cpu
+	int migrate_to; // pending migration target, -1 if none
+	struct sched_credit csched;
+	struct sched_rt rt;
+	unsigned long wakeup; // physical count to wake a blocked task, or 0
+	struct sched_latency lat;
+	struct sched_adapt adapt;
+};
+
+struct prio_array {
+	unsigned long bitmap; // bit n is set if queue[n] is not empty
+	struct list_head queue[NR_PRIO];
+};
+
+struct sched_stat {
+	unsigned long nr_schedule;
+	unsigned long cost; // counter ticks spent picking the next task
+};
+
+/*
+ * Runnable tasks are queued at PRIO_UNDER while they have credit and at
+ * PRIO_OVER once it runs out, round robin within a level. Every
+ * CSCHED_ACCT_PERIOD the elapsed time is handed out as credit in
+ * proportion to the task weights. Tasks with reservation budget left are
+ * queued above them at PRIO_RT, in deadline order.
+ */
+struct run_queue {
+	spinlock_t lock;
+	int cpu;
+	struct prio_array active;
+	struct task_struct *idle;
+	struct task_struct *curr;
+	struct list_head sleepers; // blocked tasks, earliest wakeup first
+	struct list_head rt_tasks; // tasks on this cpu with a reservation
+	unsigned long nr_running;
+	unsigned long acct_stamp; // physical count at the last accounting
+	unsigned long slice_end; // physical count when curr's slice expires
+	unsigned long next_event; // what the scheduler timer is set to
+	unsigned long boost_deadline; // latest time to switch to a boosted task
+	struct sched_stat stat;
 };
 
 extern void sched_init(void);
+extern void sched_init_cpu(void);
 extern void schedule(void);
 extern void timer_tick(void);
+extern void sched_update_timer(void);
+extern void cpu_idle(void);
 extern void preempt_disable(void);
 extern void preempt_enable(void);
+extern void activate_task(struct task_struct *);
+extern void block_current(unsigned long);
+extern void wake_up_task(struct task_struct *);
+extern int yield_to(long);
+extern unsigned long remaining_slice(void);
+extern void deactivate_task(struct task_struct *);
+extern int select_task_cpu(void);
+extern int migrate_task(struct task_struct *, int);
+extern void sched_init_task(struct task_struct *);
+extern int sched_set_weight(struct task_struct *, unsigned int);
+extern int sched_set_cap(struct task_struct *, unsigned int);
+extern int sched_set_reservation(struct task_struct *, unsigned long,
+				 unsigned long);
+extern int sched_set_policy(struct task_struct *, int);
+extern void sched_note_io(struct task_struct *);
 extern void set_cpu_virtual_interrupt(struct task_struct *);
 void set_cpu_sysregs(struct task_struct *);
 extern void switch_to(struct task_struct *);
-extern void cpu_switch_to(struct task_struct *, struct task_struct *);
+extern struct task_struct *cpu_switch_to(struct task_struct *,
+					 struct task_struct *);
+extern void schedule_tail(struct task_struct *);
+extern void check_preempt(void);
+extern unsigned long sched_boost_latency;
+extern int kill_task(struct task_struct *);
+extern int pause_task(struct task_struct *);
+extern void resume_task(struct task_struct *);
 extern void exit_task(void);
 extern void show_task_list(void);
+extern void show_task_latency(struct task_struct *);
+extern void reset_task_latency(struct task_struct *);
 
 #define INIT_TASK                                                              \
 	{                                                                      \
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+#include "common/list.h"
+#include "common/mm.h"
+#include "common/spinlock.h"
+
+#define SLAB_ORDER	  2 // every slab is a buddy block of 16 KiB
+#define SLAB_SIZE	  (PAGE_SIZE << SLAB_ORDER)
+#define SLAB_HEADER_SIZE 64 // the first object starts a cache line
+#define SLAB_ALIGN	  16
+
+#define KMALLOC_MAX_SIZE 4096 // larger objects take pages of their own
+
+/*
+ * A cache of equally sized objects. Caches are defined statically with
+ * KMEM_CACHE_INIT() and show up in show_slab_stat() once they hold a slab.
+ */
+struct kmem_cache {
+	const char *name;
+	unsigned long size; // object size, a multiple of SLAB_ALIGN
+	spinlock_t lock;
+	struct list_head partial; // slabs with free objects
+	struct list_head full;
+	struct list_head list; // on the list of all caches
+	unsigned long nr_slabs;
+	unsigned long nr_active; // objects handed out
+	unsigned long nr_allocs; // since boot
+};
+
+#define KMEM_CACHE_INIT(var, n, sz)                                         \
+	{                                                                  \
+		.name = (n),                                               \
+		.size = ((sz) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1),       \
+		.partial = LIST_HEAD_INIT((var).partial),                  \
+		.full = LIST_HEAD_INIT((var).full),                        \
+		.list = LIST_HEAD_INIT((var).list),                        \
+	}
+
+/* flags are the ALLOC_* ones of allocate_pages(), objects come zeroed */
+void *kmem_cache_alloc(struct kmem_cache *, unsigned int flags);
+void kmem_cache_free(struct kmem_cache *, void *);
+void *kmalloc(unsigned long size, unsigned int flags);
+void kfree(void *);
+void show_slab_stat(void);
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+#define NR_CPUS 4
+
+/* boot stacks, cpu n uses the one ending at LOW_MEMORY - n * CPU_STACK_SIZE */
+#define CPU_STACK_SIZE 0x10000
+
+#ifndef __ASSEMBLER__
+#include "arch/aarch64/smp.h"
+
+extern volatile unsigned long cpu_online_mask;
+
+#define cpu_online(cpu) (cpu_online_mask & (1UL << (cpu)))
+
+void smp_init(void);
+void set_cpu_online(int cpu);
+void secondary_main(void);
+void smp_send_reschedule(int cpu);
+
+#endif
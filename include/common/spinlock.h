@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * aVisor Hypervisor
+ *
+ * A Tiny Hypervisor for IoT Development
+ *
+ * Copyright (c) 2022 Deng Jie (mr.dengjie@gmail.com).
+ */
+
+#pragma once
+
+/*
+ * Ticket lock, the low half is the owner ticket and the high half is the
+ * next ticket. The hypervisor runs with interrupts masked, so there are no
+ * irqsave variants.
+ */
+typedef struct {
+	volatile unsigned int lock;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(x) spinlock_t x = { 0 }
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	lock->lock = 0;
+}
+
+extern void spin_lock(spinlock_t *);
+extern void spin_unlock(spinlock_t *);
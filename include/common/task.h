@@ -35,6 +35,8 @@ typedef int (*loader_func_t)(void *, struct pt_regs *regs);
 
 struct pt_regs *task_pt_regs(struct task_struct *);
 int create_task(loader_func_t, void *);
+int clone_task(struct task_struct *);
+void release_task(struct task_struct *);
 void init_task_console(struct task_struct *);
 int is_uart_forwarded_task(struct task_struct *);
 void flush_task_console(struct task_struct *);
@@ -12,5 +12,8 @@
 void timer_init(void);
 void handle_timer1_irq(void);
 void handle_timer3_irq(void);
+void local_timer_init(void);
+void timer_set_next_event(unsigned long deadline);
+void handle_local_timer_irq(void);
 unsigned long get_physical_timer_count(void);
 unsigned long get_system_timer(void);
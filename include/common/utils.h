@@ -24,12 +24,20 @@ struct cpu_sysregs;
 
 void memzero(void *, size_t);
 void memcpy(void *, const void *, size_t);
+void init_dc_zva(void);
+
+extern unsigned long zva_size; // DC ZVA block size in bytes, 0 if unusable
 
 extern void delay(unsigned long);
 extern void put32(unsigned long, unsigned int);
 extern unsigned int get32(unsigned long);
 extern unsigned long get_el(void);
 extern void set_stage2_pgd(unsigned long, unsigned long);
+extern void flush_stage2_tlb(void);
+extern void flush_vmid_tlb(unsigned long);
+extern void flush_ipa_tlb(unsigned long, unsigned long);
+extern void dcache_clean_inval_range(void *, unsigned long);
+extern void icache_inval_all(void);
 extern void restore_sysregs(struct cpu_sysregs *);
 extern void save_sysregs(struct cpu_sysregs *);
 extern void get_all_sysregs(struct cpu_sysregs *);